@@ -0,0 +1,170 @@
+// A thin client for janetsh -server. It runs a janetsh script in a
+// process forked from the warm server instead of starting janetsh,
+// passing its arguments, working directory, environment and standard
+// fds, and exits with the script's exit code.
+//
+// usage: JANETSH_SOCKET=path janetsh-client script [args]
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../shlib/server-protocol.h"
+
+extern char **environ;
+
+static volatile sig_atomic_t script_pid = 0;
+// Signals that arrived before the server told us the script's pid, as
+// a mask of 1 << sig.
+static volatile sig_atomic_t pending_signals = 0;
+
+static void die(const char *msg) {
+  fprintf(stderr, "janetsh-client: %s\n", msg);
+  exit(127);
+}
+
+static void die_errno(const char *msg) {
+  fprintf(stderr, "janetsh-client: %s: %s\n", msg, strerror(errno));
+  exit(127);
+}
+
+static void forward_signal(int sig) {
+  if (script_pid > 0)
+    kill(script_pid, sig);
+  else
+    pending_signals |= 1 << sig;
+}
+
+static int write_all(int fd, const char *buf, size_t n) {
+  while (n) {
+    ssize_t w = write(fd, buf, n);
+    if (w == -1) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    buf += w;
+    n -= w;
+  }
+  return 0;
+}
+
+static int read_int(int fd, int32_t *n) {
+  char *buf = (char *)n;
+  size_t left = sizeof(*n);
+  while (left) {
+    ssize_t r = read(fd, buf, left);
+    if (r == -1 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      return -1;
+    buf += r;
+    left -= r;
+  }
+  return 0;
+}
+
+static void push(char **buf, size_t *len, size_t *cap, const char *s) {
+  size_t n = strlen(s) + 1;
+  if (*len + n > *cap) {
+    *cap = (*len + n) * 2;
+    *buf = realloc(*buf, *cap);
+    if (!*buf)
+      die("out of memory");
+  }
+  memcpy(*buf + *len, s, n);
+  *len += n;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: JANETSH_SOCKET=path janetsh-client script [args]\n");
+    return 127;
+  }
+  const char *path = getenv("JANETSH_SOCKET");
+  if (!path)
+    die("JANETSH_SOCKET is not set");
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path))
+    die("socket path too long");
+  strcpy(addr.sun_path, path);
+
+  signal(SIGPIPE, SIG_IGN);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1)
+    die_errno("socket");
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    die_errno(path);
+
+  char cwd[PATH_MAX];
+  if (!getcwd(cwd, sizeof(cwd)))
+    die_errno("getcwd");
+
+  char *buf = NULL;
+  size_t len = 0, cap = 0;
+  ServerRequest req = {.nargs = argc - 1, .nenv = 0};
+  push(&buf, &len, &cap, cwd);
+  for (int i = 1; i < argc; i++)
+    push(&buf, &len, &cap, argv[i]);
+  for (char **e = environ; *e; e++, req.nenv++)
+    push(&buf, &len, &cap, *e);
+  if (len > SERVER_MAX_REQUEST)
+    die("arguments and environment too large");
+  req.len = len;
+
+  int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(fds))];
+  } control;
+  memset(&control, 0, sizeof(control));
+  struct iovec iov = {.iov_base = &req, .iov_len = sizeof(req)};
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  ssize_t r;
+  do {
+    r = sendmsg(fd, &msg, 0);
+  } while (r == -1 && errno == EINTR);
+  if (r != sizeof(req) || write_all(fd, buf, len) == -1)
+    die("sending request");
+  free(buf);
+
+  // The script doesn't run in our process group, so pass on the
+  // signals a terminal or parent would send us.
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = forward_signal;
+  int sigs[] = {SIGINT, SIGQUIT, SIGTERM, SIGHUP};
+  for (size_t i = 0; i < sizeof(sigs) / sizeof(sigs[0]); i++)
+    sigaction(sigs[i], &sa, NULL);
+
+  int32_t pid, status;
+  if (read_int(fd, &pid) == -1)
+    die("no reply from server");
+  script_pid = pid;
+  for (size_t i = 0; i < sizeof(sigs) / sizeof(sigs[0]); i++)
+    if (pid > 0 && (pending_signals & (1 << sigs[i])))
+      kill(pid, sigs[i]);
+  if (read_int(fd, &status) == -1)
+    die("lost connection to server");
+  return status;
+}
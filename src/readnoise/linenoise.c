@@ -114,16 +114,20 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <poll.h>
 #include <unistd.h>
 #include "linenoise.h"
 
 #define LINENOISE_DEFAULT_HISTORY_MAX_LEN 100
-#define LINENOISE_MAX_LINE 4096
+#define LINENOISE_INITIAL_LINE 256
+#define LINENOISE_INPUT_BUF 4096
+#define LINENOISE_EVENT_INTERVAL 100 /* Milliseconds between event hooks. */
 #define UNUSED(x) (void)(x)
 static char *unsupported_term[] = {"dumb", "cons25", "emacs", NULL};
 static linenoiseCompletionCallback *completionCallback = NULL;
 static linenoiseHintsCallback *hintsCallback = NULL;
 static linenoiseFreeHintsCallback *freeHintsCallback = NULL;
+static linenoiseEventHook *eventHook = NULL;
 
 static struct termios orig_termios; /* In order to restore at exit.*/
 static int rawmode = 0; /* For atexit() function to check if restore is needed*/
@@ -132,6 +136,11 @@ static int atexit_registered = 0; /* Register atexit just 1 time. */
 static int history_max_len = LINENOISE_DEFAULT_HISTORY_MAX_LEN;
 static int history_len = 0;
 static char **history = NULL;
+static char inbuf[LINENOISE_INPUT_BUF]; /* Terminal input read ahead. */
+static size_t inbuf_pos = 0;
+static size_t inbuf_len = 0;
+static struct linenoiseState *activeState = NULL; /* Line being edited. */
+static char *activePrompt = NULL; /* Prompt from linenoiseSetPrompt(). */
 
 /* The linenoiseState structure represents the state during line editing.
  * We pass this state to functions implementing specific editing
@@ -139,8 +148,10 @@ static char **history = NULL;
 struct linenoiseState {
   int ifd;            /* Terminal stdin file descriptor. */
   int ofd;            /* Terminal stdout file descriptor. */
-  char *buf;          /* Edited line buffer. */
-  size_t buflen;      /* Edited line buffer size. */
+  char *buf;          /* Edited line gap buffer. */
+  size_t buflen;      /* Edited line gap buffer size. */
+  char *view;         /* Contiguous copy of the line for callbacks. */
+  size_t viewlen;     /* Contiguous copy buffer size. */
   const char *prompt; /* Prompt to display. */
   size_t plen;        /* Prompt length. */
   size_t pos;         /* Current cursor position. */
@@ -149,6 +160,9 @@ struct linenoiseState {
   size_t cols;        /* Number of columns in terminal. */
   size_t maxrows;     /* Maximum num of rows used so far (multiline mode) */
   int history_index;  /* The history index we are currently editing. */
+  int needrefresh;    /* A redraw was deferred while input was pending. */
+  int cursorcol;      /* Cursor column after the last refresh. */
+  int rowsbelow;      /* Rows of the line below the cursor after refresh. */
 };
 
 enum KEY_ACTION {
@@ -176,6 +190,7 @@ enum KEY_ACTION {
 static void linenoiseAtExit(void);
 int linenoiseHistoryAdd(const char *line);
 static void refreshLine(struct linenoiseState *l);
+static void refreshLineNow(struct linenoiseState *l);
 
 /* Debugging macro. */
 #if 0
@@ -225,7 +240,7 @@ static size_t defaultNextCharLen(const char *buf, size_t buf_len, size_t pos,
 static size_t defaultReadCode(int fd, char *buf, size_t buf_len, int *c) {
   if (buf_len < 1)
     return -1;
-  int nread = read(fd, &buf[0], 1);
+  int nread = linenoiseReadInput(fd, &buf[0], 1);
   if (nread == 1)
     *c = buf[0];
   return nread;
@@ -339,7 +354,13 @@ static int enableRawMode(int fd) {
   /* put terminal in raw mode after flushing */
   if (tcsetattr(fd, TCSAFLUSH, &raw) < 0)
     goto fatal;
+  /* Pending input was just discarded, so discard what we read ahead too. */
+  inbuf_pos = inbuf_len = 0;
   rawmode = 1;
+  /* Ask the terminal to mark pastes with ESC [ 200 ~ ... ESC [ 201 ~ */
+  if (write(STDOUT_FILENO, "\x1b[?2004h", 8) == -1) {
+    /* Not fatal, pastes are then just typed in. */
+  }
   return 0;
 
 fatal:
@@ -349,10 +370,49 @@ fatal:
 
 static void disableRawMode(int fd) {
   /* Don't even check the return value as it's too late. */
+  if (rawmode && write(STDOUT_FILENO, "\x1b[?2004l", 8) == -1) {
+  }
   if (rawmode && tcsetattr(fd, TCSAFLUSH, &orig_termios) != -1)
     rawmode = 0;
 }
 
+/* Read exactly 'len' bytes of terminal input, unless end of file or an
+ * error comes first. Input is read ahead into a buffer, so a burst of
+ * input like a paste costs one read() call rather than one per byte.
+ * Returns the number of bytes read, or -1 on error. */
+int linenoiseReadInput(int fd, char *buf, size_t len) {
+  size_t n = 0;
+
+  while (n < len) {
+    size_t avail;
+
+    if (inbuf_pos == inbuf_len) {
+      int nread = read(fd, inbuf, sizeof(inbuf));
+      if (nread <= 0)
+        return n ? (int)n : nread;
+      inbuf_pos = 0;
+      inbuf_len = nread;
+    }
+    avail = inbuf_len - inbuf_pos;
+    if (avail > len - n)
+      avail = len - n;
+    memcpy(buf + n, inbuf + inbuf_pos, avail);
+    inbuf_pos += avail;
+    n += avail;
+  }
+  return n;
+}
+
+/* Return true if input has already been read ahead and is waiting. */
+static int inputPending(void) { return inbuf_pos != inbuf_len; }
+
+/* Return true if a read of fd would not block, because input is either
+ * buffered or waiting in the kernel. */
+static int inputReady(int fd) {
+  struct pollfd pfd = {fd, POLLIN, 0};
+  return inputPending() || poll(&pfd, 1, 0) == 1;
+}
+
 /* Use the ESC [6n escape sequence to query the horizontal cursor position
  * and return it. On error -1 is returned, on success the position of the
  * cursor. */
@@ -367,7 +427,7 @@ static int getCursorPosition(int ifd, int ofd) {
 
   /* Read the response: ESC [ rows ; cols R */
   while (i < sizeof(buf) - 1) {
-    if (read(ifd, buf + i, 1) != 1)
+    if (linenoiseReadInput(ifd, buf + i, 1) != 1)
       break;
     if (buf[i] == 'R')
       break;
@@ -435,81 +495,457 @@ static void linenoiseBeep(void) {
   fflush(stderr);
 }
 
+/* ============================== Gap buffer ================================ */
+
+/* The edited line lives in a heap allocated gap buffer. The gap always sits
+ * at the cursor, so inserting or deleting at the cursor is O(1) amortized
+ * regardless of the line length, and the buffer grows on demand:
+ *
+ *   [ text before cursor | gap | text after cursor ]
+ *   0                    pos   pos+gap             buflen
+ *
+ * The gap is never empty so the line can always be NUL terminated in place
+ * once editing is done. */
+
+/* Size of the gap. */
+static size_t gbGap(struct linenoiseState *l) { return l->buflen - l->len; }
+
+/* Start of the text after the cursor. */
+static char *gbTail(struct linenoiseState *l) {
+  return l->buf + l->pos + gbGap(l);
+}
+
+/* Length of the text after the cursor. */
+static size_t gbTailLen(struct linenoiseState *l) { return l->len - l->pos; }
+
+static int gbInit(struct linenoiseState *l) {
+  l->buflen = LINENOISE_INITIAL_LINE;
+  l->buf = malloc(l->buflen);
+  if (l->buf == NULL)
+    return -1;
+  l->view = NULL;
+  l->viewlen = 0;
+  l->pos = l->len = 0;
+  return 0;
+}
+
+static void gbFree(struct linenoiseState *l) {
+  free(l->buf);
+  free(l->view);
+  l->buf = l->view = NULL;
+}
+
+/* Make sure 'need' bytes can be inserted at the cursor while still
+ * leaving room for the NUL terminator. On error -1 is returned. */
+static int gbReserve(struct linenoiseState *l, size_t need) {
+  size_t taillen = gbTailLen(l);
+  size_t newlen = l->buflen;
+  char *newbuf;
+
+  if (gbGap(l) > need)
+    return 0;
+  while (newlen - l->len <= need)
+    newlen *= 2;
+  newbuf = realloc(l->buf, newlen);
+  if (newbuf == NULL)
+    return -1;
+  /* The tail always ends at the end of the buffer. */
+  memmove(newbuf + newlen - taillen, newbuf + l->buflen - taillen, taillen);
+  l->buf = newbuf;
+  l->buflen = newlen;
+  return 0;
+}
+
+/* Move the cursor (and the gap with it) to byte offset 'pos'. */
+static void gbMoveTo(struct linenoiseState *l, size_t pos) {
+  size_t gap = gbGap(l);
+
+  if (pos < l->pos)
+    memmove(l->buf + pos + gap, l->buf + pos, l->pos - pos);
+  else if (pos > l->pos)
+    memmove(l->buf + l->pos, l->buf + l->pos + gap, pos - l->pos);
+  l->pos = pos;
+}
+
+/* Insert 'len' bytes at the cursor. On error -1 is returned. */
+static int gbInsert(struct linenoiseState *l, const char *s, size_t len) {
+  if (gbReserve(l, len) == -1)
+    return -1;
+  memcpy(l->buf + l->pos, s, len);
+  l->pos += len;
+  l->len += len;
+  return 0;
+}
+
+/* Replace the whole line with 's', leaving the cursor at the end. */
+static int gbSet(struct linenoiseState *l, const char *s) {
+  l->pos = l->len = 0;
+  return gbInsert(l, s, strlen(s));
+}
+
+/* Column length of the whole line. */
+static size_t gbColumns(struct linenoiseState *l) {
+  return columnPos(l->buf, l->pos, l->pos) +
+         columnPos(gbTail(l), gbTailLen(l), gbTailLen(l));
+}
+
+/* Return the line as a contiguous NUL terminated string without moving
+ * the gap. The result is only valid until the next call. */
+static const char *gbText(struct linenoiseState *l) {
+  if (l->viewlen <= l->len) {
+    char *view = realloc(l->view, l->len + 1);
+    if (view == NULL)
+      return "";
+    l->view = view;
+    l->viewlen = l->len + 1;
+  }
+  memcpy(l->view, l->buf, l->pos);
+  memcpy(l->view + l->pos, gbTail(l), gbTailLen(l));
+  l->view[l->len] = '\0';
+  return l->view;
+}
+
+/* Close the gap and return the line NUL terminated in place. */
+static char *gbFinish(struct linenoiseState *l) {
+  gbMoveTo(l, l->len);
+  l->buf[l->len] = '\0';
+  return l->buf;
+}
+
+/* ============================== Append buffer ============================= */
+
+/* We define a very simple "append buffer" structure, that is an heap
+ * allocated string where we can append to. This is useful in order to
+ * write all the escape sequences in a buffer and flush them to the standard
+ * output in a single call, to avoid flickering effects. */
+struct abuf {
+  char *b;
+  int len;
+};
+
+static void abInit(struct abuf *ab) {
+  ab->b = NULL;
+  ab->len = 0;
+}
+
+static void abAppend(struct abuf *ab, const char *s, int len) {
+  char *new = realloc(ab->b, ab->len + len);
+
+  if (new == NULL)
+    return;
+  memcpy(new + ab->len, s, len);
+  ab->b = new;
+  ab->len += len;
+}
+
+static void abFree(struct abuf *ab) { free(ab->b); }
+
+/* Append line text, showing newlines (kept from pastes) as a single
+ * reverse video cell so they don't break the layout of the line. */
+static void abAppendText(struct abuf *ab, const char *s, int len) {
+  const char *nl;
+
+  while (len > 0 && (nl = memchr(s, '\n', len)) != NULL) {
+    abAppend(ab, s, nl - s);
+    abAppend(ab, "\033[7m \033[0m", 9);
+    len -= nl - s + 1;
+    s = nl + 1;
+  }
+  abAppend(ab, s, len);
+}
+
 /* ============================== Completion ================================ */
 
+/* Candidates live back to back, NUL terminated, in a single growable
+ * arena, with the offset of each kept in offs. Adding a candidate is a
+ * copy into the arena and amortized O(1), however many there are. */
+
+/* Return candidate i of lc. */
+static const char *lcGet(const linenoiseCompletions *lc, size_t i) {
+  return lc->arena + lc->offs[i];
+}
+
+/* Return the length in bytes of candidate i of lc. */
+static size_t lcLen(const linenoiseCompletions *lc, size_t i) {
+  size_t end = i + 1 < lc->len ? lc->offs[i + 1] : lc->used;
+  return end - lc->offs[i] - 1;
+}
+
 /* Free a list of completion option populated by linenoiseAddCompletion(). */
 static void freeCompletions(linenoiseCompletions *lc) {
-  size_t i;
-  for (i = 0; i < lc->len; i++)
-    free(lc->cvec[i]);
-  if (lc->cvec != NULL)
-    free(lc->cvec);
+  free(lc->offs);
+  free(lc->arena);
+  memset(lc, 0, sizeof(*lc));
+}
+
+/* The menu shown when there is more than one candidate. It keeps the
+ * indexes of the candidates matching the current line, which shrinks as
+ * the user types, and only the page holding the selection is drawn. */
+struct linenoiseMenu {
+  linenoiseCompletions *lc;
+  size_t *match;   /* Indexes of the candidates matching the line. */
+  size_t nmatch;   /* Number of matching candidates. */
+  size_t sel;      /* Selected match, nmatch when there is none. */
+  size_t skip;     /* Bytes of each candidate not shown in the menu. */
+  size_t cellcols; /* Columns of each menu cell. */
+};
+
+/* Try to get the number of rows in the current terminal, or assume 24
+ * if it fails. */
+static int getRows(int ofd) {
+  struct winsize ws;
+
+  if (ioctl(ofd, TIOCGWINSZ, &ws) == -1 || ws.ws_row == 0)
+    return 24;
+  return ws.ws_row;
+}
+
+/* Length of the longest common prefix of all candidates in lc. */
+static size_t lcCommonPrefix(const linenoiseCompletions *lc) {
+  size_t i, n = lcLen(lc, 0);
+  const char *first = lcGet(lc, 0);
+
+  for (i = 1; i < lc->len && n; i++) {
+    const char *s = lcGet(lc, i);
+    size_t j = 0;
+    while (j < n && s[j] == first[j])
+      j++;
+    n = j;
+  }
+  return n;
+}
+
+/* Keep the menu entries that start with the current line. When the line
+ * only grew since the last call the previous matches are filtered,
+ * otherwise all candidates are checked again. */
+static void menuFilter(struct linenoiseMenu *m, const char *line, int grew) {
+  size_t i, n = 0, len = strlen(line), widest = 0;
+  size_t from = grew ? m->nmatch : m->lc->len;
+
+  for (i = 0; i < from; i++) {
+    size_t idx = grew ? m->match[i] : i;
+    if (lcLen(m->lc, idx) >= len && !memcmp(lcGet(m->lc, idx), line, len))
+      m->match[n++] = idx;
+  }
+  m->nmatch = n;
+  m->sel = n;
+  for (i = 0; i < n; i++) {
+    const char *s = lcGet(m->lc, m->match[i]) + m->skip;
+    size_t slen = lcLen(m->lc, m->match[i]) - m->skip;
+    size_t cols = columnPos(s, slen, slen);
+    if (cols > widest)
+      widest = cols;
+  }
+  m->cellcols = widest + 2;
+}
+
+/* Append the menu text s to ab, cut or padded to exactly cols columns. */
+static void abAppendCell(struct abuf *ab, const char *s, size_t len,
+                         size_t cols) {
+  size_t off = 0, used = 0;
+
+  while (off < len) {
+    size_t col_len;
+    size_t chlen = nextCharLen(s, len, off, &col_len);
+    if (used + col_len > cols)
+      break;
+    off += chlen;
+    used += col_len;
+  }
+  abAppendText(ab, s, off);
+  while (used++ < cols)
+    abAppend(ab, " ", 1);
+}
+
+/* Draw the line followed by the page of the menu holding the selection,
+ * leaving the cursor where it was on the line. */
+static void refreshMenu(struct linenoiseState *ls, struct linenoiseMenu *m) {
+  char seq[64];
+  size_t ncols, pagerows, pagesize, page, npages, first, r, c;
+  int drawn = 0;
+  struct abuf ab;
+
+  refreshLineNow(ls);
+
+  ncols = ls->cols / m->cellcols;
+  if (ncols == 0)
+    ncols = 1;
+  pagerows = getRows(ls->ofd) / 2;
+  if (pagerows < 2)
+    pagerows = 2;
+  /* Leave a row for the page indicator. */
+  pagerows--;
+  pagesize = ncols * pagerows;
+  npages = (m->nmatch + pagesize - 1) / pagesize;
+  page = m->sel < m->nmatch ? m->sel / pagesize : 0;
+  first = page * pagesize;
+
+  abInit(&ab);
+  if (ls->rowsbelow > 0) {
+    snprintf(seq, 64, "\x1b[%dB", ls->rowsbelow);
+    abAppend(&ab, seq, strlen(seq));
+  }
+  abAppend(&ab, "\r\n\x1b[J", 5);
+  for (r = 0; r < pagerows && first + r * ncols < m->nmatch; r++) {
+    if (r)
+      abAppend(&ab, "\r\n", 2);
+    for (c = 0; c < ncols; c++) {
+      size_t i = first + r * ncols + c;
+      size_t idx;
+      if (i >= m->nmatch)
+        break;
+      idx = m->match[i];
+      if (i == m->sel)
+        abAppend(&ab, "\x1b[7m", 4);
+      abAppendCell(&ab, lcGet(m->lc, idx) + m->skip,
+                   lcLen(m->lc, idx) - m->skip,
+                   m->cellcols > ls->cols ? ls->cols : m->cellcols - 2);
+      if (i == m->sel)
+        abAppend(&ab, "\x1b[0m", 4);
+      if (c + 1 < ncols && i + 1 < m->nmatch)
+        abAppend(&ab, "  ", 2);
+    }
+    drawn++;
+  }
+  if (npages > 1) {
+    /* Three size_t counts need more room than seq has. */
+    char status[128];
+    snprintf(status, sizeof(status),
+             "\r\n\x1b[7m-- %zu/%zu (%zu matches) --\x1b[0m", page + 1,
+             npages, m->nmatch);
+    abAppend(&ab, status, strlen(status));
+    drawn++;
+  }
+  /* Back up to the cursor. */
+  snprintf(seq, 64, "\x1b[%dA\r", drawn + ls->rowsbelow);
+  abAppend(&ab, seq, strlen(seq));
+  if (ls->cursorcol > 0) {
+    snprintf(seq, 64, "\x1b[%dC", ls->cursorcol);
+    abAppend(&ab, seq, strlen(seq));
+  }
+  if (write(ls->ofd, ab.b, ab.len) == -1) {
+  } /* Can't recover from write error. */
+  abFree(&ab);
+}
+
+/* Erase the menu from the screen. */
+static void clearMenu(struct linenoiseState *ls) {
+  char seq[64];
+
+  snprintf(seq, 64, "\x1b[%dB\r\x1b[J\x1b[%dA\r", ls->rowsbelow + 1,
+           ls->rowsbelow + 1);
+  if (write(ls->ofd, seq, strlen(seq)) == -1) {
+  } /* Can't recover from write error. */
+  refreshLineNow(ls);
 }
 
 /* This is an helper function for linenoiseEdit() and is called when the
  * user types the <tab> key in order to complete the string currently in the
  * input.
  *
+ * A single candidate replaces the line. Otherwise the line is extended to
+ * the longest common prefix of the candidates and a menu of them is shown.
+ * Typing narrows the menu, tab and ctrl-n/ctrl-p move the selection and
+ * enter puts the selected candidate on the line. Any other key closes the
+ * menu and is returned in *c to be handled as usual.
+ *
  * The state of the editing is encapsulated into the pointed linenoiseState
  * structure as described in the structure definition. */
 static int completeLine(struct linenoiseState *ls, char *cbuf, size_t cbuf_len,
                         int *c) {
-  linenoiseCompletions lc = {0, NULL};
-  int nread = 0, nwritten;
+  linenoiseCompletions lc = {0};
+  struct linenoiseMenu m;
+  size_t pfxlen, i;
+  int nread = 0;
   *c = 0;
 
-  completionCallback(ls->buf, &lc);
+  /* Keys typed after the tab supersede it, so don't start a completion
+   * that would only delay them. The callback may likewise give up when
+   * input arrives, in which case there is nothing to beep about. */
+  if (inputPending())
+    return 0;
+  completionCallback(gbText(ls), &lc);
   if (lc.len == 0) {
-    linenoiseBeep();
-  } else {
-    size_t stop = 0, i = 0;
-
-    while (!stop) {
-      /* Show completion or original buffer */
-      if (i < lc.len) {
-        struct linenoiseState saved = *ls;
-
-        ls->len = ls->pos = strlen(lc.cvec[i]);
-        ls->buf = lc.cvec[i];
-        refreshLine(ls);
-        ls->len = saved.len;
-        ls->pos = saved.pos;
-        ls->buf = saved.buf;
-      } else {
-        refreshLine(ls);
-      }
+    if (!inputReady(ls->ifd))
+      linenoiseBeep();
+    freeCompletions(&lc);
+    return 0;
+  }
 
-      nread = readCode(ls->ifd, cbuf, cbuf_len, c);
-      if (nread <= 0) {
-        freeCompletions(&lc);
-        *c = -1;
-        return nread;
-      }
+  pfxlen = lcCommonPrefix(&lc);
+  if (lc.len == 1 ||
+      (pfxlen > ls->len && !memcmp(lcGet(&lc, 0), gbText(ls), ls->len))) {
+    char *pfx = malloc(pfxlen + 1);
+    if (pfx != NULL) {
+      memcpy(pfx, lcGet(&lc, 0), pfxlen);
+      pfx[pfxlen] = '\0';
+      gbSet(ls, pfx);
+      free(pfx);
+    }
+    refreshLine(ls);
+  }
+  if (lc.len == 1) {
+    freeCompletions(&lc);
+    return 0;
+  }
 
-      switch (*c) {
-      case 9: /* tab */
-        i = (i + 1) % (lc.len + 1);
-        if (i == lc.len)
-          linenoiseBeep();
-        break;
-      case 27: /* escape */
-        /* Re-show original buffer */
-        if (i < lc.len)
-          refreshLine(ls);
-        stop = 1;
+  m.lc = &lc;
+  m.match = malloc(sizeof(size_t) * lc.len);
+  if (m.match == NULL) {
+    freeCompletions(&lc);
+    return 0;
+  }
+  m.nmatch = 0;
+  /* Show candidates from the start of the last word or path component
+   * they all share, as a file name or command. */
+  m.skip = 0;
+  for (i = 0; i < pfxlen; i++)
+    if (lcGet(&lc, 0)[i] == ' ' || lcGet(&lc, 0)[i] == '/')
+      m.skip = i + 1;
+  menuFilter(&m, gbText(ls), 0);
+  /* Fuzzy candidates need not start with the line, so show them all. */
+  if (m.nmatch == 0)
+    menuFilter(&m, "", 0);
+
+  while (1) {
+    if (!inputPending())
+      refreshMenu(ls, &m);
+
+    nread = readCode(ls->ifd, cbuf, cbuf_len, c);
+    if (nread <= 0) {
+      *c = -1;
+      break;
+    }
+
+    if (*c == TAB || *c == CTRL_N) {
+      m.sel = m.sel + 1 < m.nmatch ? m.sel + 1 : 0;
+    } else if (*c == CTRL_P) {
+      m.sel = m.sel > 0 && m.sel < m.nmatch ? m.sel - 1 : m.nmatch - 1;
+    } else if (*c == ENTER && m.sel < m.nmatch) {
+      gbSet(ls, lcGet(&lc, m.match[m.sel]));
+      *c = 0;
+      break;
+    } else if ((*c == BACKSPACE || *c == CTRL_H) && ls->pos > 0 &&
+               ls->pos == ls->len) {
+      gbMoveTo(ls, ls->pos - prevCharLen(ls->buf, ls->pos, ls->pos, NULL));
+      ls->len = ls->pos;
+      menuFilter(&m, gbText(ls), 0);
+    } else if ((unsigned char)cbuf[0] >= 32 && *c != BACKSPACE &&
+               ls->pos == ls->len) {
+      if (gbInsert(ls, cbuf, nread) == -1)
         break;
-      default:
-        /* Update buffer and return */
-        if (i < lc.len) {
-          nwritten = snprintf(ls->buf, ls->buflen, "%s", lc.cvec[i]);
-          ls->len = ls->pos = nwritten;
-        }
-        stop = 1;
+      menuFilter(&m, gbText(ls), 1);
+      if (m.nmatch == 0) {
+        *c = 0;
         break;
       }
+    } else {
+      break;
     }
   }
 
+  clearMenu(ls);
+  free(m.match);
   freeCompletions(&lc);
   return nread;
 }
@@ -531,63 +967,100 @@ void linenoiseSetFreeHintsCallback(linenoiseFreeHintsCallback *fn) {
   freeHintsCallback = fn;
 }
 
-/* This function is used by the callback function registered by the user
- * in order to add completion options given the input string when the
- * user typed <tab>. See the example.c source code for a very easy to
- * understand example. */
-void linenoiseAddCompletion(linenoiseCompletions *lc, const char *str) {
-  size_t len = strlen(str);
-  char *copy, **cvec;
+/* Add the concatenation of prefix and str as a completion candidate. This
+ * lets callers that complete a word within the line avoid building the
+ * whole line themselves. */
+void linenoiseAddCompletionPrefixed(linenoiseCompletions *lc,
+                                    const char *prefix, size_t plen,
+                                    const char *str, size_t len) {
+  size_t need = lc->used + plen + len + 1;
+
+  if (need > lc->size) {
+    size_t size = lc->size ? lc->size : 4096;
+    char *arena;
+    while (size < need)
+      size *= 2;
+    arena = realloc(lc->arena, size);
+    if (arena == NULL)
+      return;
+    lc->arena = arena;
+    lc->size = size;
+  }
+  if (lc->len == lc->cap) {
+    size_t cap = lc->cap ? lc->cap * 2 : 64;
+    size_t *offs = realloc(lc->offs, sizeof(size_t) * cap);
+    if (offs == NULL)
+      return;
+    lc->offs = offs;
+    lc->cap = cap;
+  }
+  lc->offs[lc->len++] = lc->used;
+  memcpy(lc->arena + lc->used, prefix, plen);
+  memcpy(lc->arena + lc->used + plen, str, len);
+  lc->used += plen + len;
+  lc->arena[lc->used++] = '\0';
+}
 
-  copy = malloc(len + 1);
-  if (copy == NULL)
+/* Register a function to be called periodically while waiting for a key,
+ * which may change the prompt with linenoiseSetPrompt() and redraw the
+ * line with linenoiseRefreshLine(). */
+void linenoiseSetEventHook(linenoiseEventHook *fn) { eventHook = fn; }
+
+/* Change the prompt of the line being edited. */
+void linenoiseSetPrompt(const char *prompt) {
+  char *copy;
+
+  if (activeState == NULL)
     return;
-  memcpy(copy, str, len + 1);
-  cvec = realloc(lc->cvec, sizeof(char *) * (lc->len + 1));
-  if (cvec == NULL) {
-    free(copy);
+  copy = strdup(prompt);
+  if (copy == NULL)
     return;
-  }
-  lc->cvec = cvec;
-  lc->cvec[lc->len++] = copy;
+  free(activePrompt);
+  activePrompt = copy;
+  activeState->prompt = copy;
+  activeState->plen = strlen(copy);
 }
 
-/* =========================== Line editing ================================= */
+/* Redraw the line being edited. */
+void linenoiseRefreshLine(void) {
+  if (activeState != NULL)
+    refreshLineNow(activeState);
+}
 
-/* We define a very simple "append buffer" structure, that is an heap
- * allocated string where we can append to. This is useful in order to
- * write all the escape sequences in a buffer and flush them to the standard
- * output in a single call, to avoid flickering effects. */
-struct abuf {
-  char *b;
-  int len;
-};
+/* Wait for a key, calling the event hook every LINENOISE_EVENT_INTERVAL
+ * milliseconds until one arrives. */
+static void waitForInput(int fd) {
+  struct pollfd pfd = {fd, POLLIN, 0};
+  int r;
 
-static void abInit(struct abuf *ab) {
-  ab->b = NULL;
-  ab->len = 0;
+  while ((r = poll(&pfd, 1, LINENOISE_EVENT_INTERVAL)) != 1) {
+    if (r == -1 && errno != EINTR)
+      return;
+    eventHook();
+  }
 }
 
-static void abAppend(struct abuf *ab, const char *s, int len) {
-  char *new = realloc(ab->b, ab->len + len);
-
-  if (new == NULL)
-    return;
-  memcpy(new + ab->len, s, len);
-  ab->b = new;
-  ab->len += len;
+/* This function is used by the callback function registered by the user
+ * in order to add completion options given the input string when the
+ * user typed <tab>. See the example.c source code for a very easy to
+ * understand example. */
+void linenoiseAddCompletion(linenoiseCompletions *lc, const char *str) {
+  linenoiseAddCompletionPrefixed(lc, "", 0, str, strlen(str));
 }
 
-static void abFree(struct abuf *ab) { free(ab->b); }
+/* =========================== Line editing ================================= */
 
 /* Helper of refreshSingleLine() and refreshMultiLine() to show hints
  * to the right of the prompt. */
 void refreshShowHints(struct abuf *ab, struct linenoiseState *l, int pcollen) {
   char seq[64];
-  size_t collen = pcollen + columnPos(l->buf, l->len, l->len);
-  if (hintsCallback && collen < l->cols) {
+  size_t collen;
+  if (!hintsCallback)
+    return;
+  collen = pcollen + gbColumns(l);
+  if (collen < l->cols) {
     int color = -1, bold = 0;
-    char *hint = hintsCallback(l->buf, &color, &bold);
+    char *hint = hintsCallback(gbText(l), &color, &bold);
     if (hint) {
       int hintlen = strlen(hint);
       int hintmaxlen = l->cols - collen;
@@ -642,18 +1115,20 @@ static int isAnsiEscape(const char *buf, size_t buf_len, size_t *len) {
 /* Get column length of prompt text
  */
 static size_t promptTextColumnLen(const char *prompt, size_t plen) {
-  char buf[LINENOISE_MAX_LINE];
-  size_t buf_len = 0;
+  size_t ret = 0;
+  size_t start = 0;
   size_t off = 0;
   while (off < plen) {
     size_t len;
     if (isAnsiEscape(prompt + off, plen - off, &len)) {
+      ret += columnPos(prompt + start, off - start, off - start);
       off += len;
+      start = off;
       continue;
     }
-    buf[buf_len++] = prompt[off++];
+    off++;
   }
-  return columnPos(buf, buf_len, buf_len);
+  return ret + columnPos(prompt + start, off - start, off - start);
 }
 
 /* Single line low level line refresh.
@@ -664,19 +1139,31 @@ static void refreshSingleLine(struct linenoiseState *l) {
   char seq[64];
   size_t pcollen = promptTextColumnLen(l->prompt, strlen(l->prompt));
   int fd = l->ofd;
+  /* The text before and after the cursor sit on either side of the gap. */
   char *buf = l->buf;
-  size_t len = l->len;
   size_t pos = l->pos;
+  size_t poscol = columnPos(buf, pos, pos);
+  char *tail = gbTail(l);
+  size_t taillen = gbTailLen(l);
+  size_t tailshown = 0, tailcol = 0;
   struct abuf ab;
 
-  while ((pcollen + columnPos(buf, len, pos)) >= l->cols) {
-    int chlen = nextCharLen(buf, len, 0, NULL);
+  /* Scroll until the cursor fits on screen. */
+  while (pos > 0 && pcollen + poscol >= l->cols) {
+    size_t col_len;
+    size_t chlen = nextCharLen(buf, pos, 0, &col_len);
     buf += chlen;
-    len -= chlen;
     pos -= chlen;
+    poscol -= col_len;
   }
-  while (pcollen + columnPos(buf, len, len) > l->cols) {
-    len -= prevCharLen(buf, len, len, NULL);
+  /* Then show as much of the text after the cursor as fits. */
+  while (tailshown < taillen) {
+    size_t col_len;
+    size_t chlen = nextCharLen(tail, taillen, tailshown, &col_len);
+    if (pcollen + poscol + tailcol + col_len > l->cols)
+      break;
+    tailshown += chlen;
+    tailcol += col_len;
   }
 
   abInit(&ab);
@@ -685,15 +1172,18 @@ static void refreshSingleLine(struct linenoiseState *l) {
   abAppend(&ab, seq, strlen(seq));
   /* Write the prompt and the current buffer content */
   abAppend(&ab, l->prompt, strlen(l->prompt));
-  abAppend(&ab, buf, len);
+  abAppendText(&ab, buf, pos);
+  abAppendText(&ab, tail, tailshown);
   /* Show hits if any. */
   refreshShowHints(&ab, l, pcollen);
   /* Erase to right */
   snprintf(seq, 64, "\x1b[0K");
   abAppend(&ab, seq, strlen(seq));
   /* Move cursor to original position. */
-  snprintf(seq, 64, "\r\x1b[%dC", (int)(columnPos(buf, len, pos) + pcollen));
+  snprintf(seq, 64, "\r\x1b[%dC", (int)(poscol + pcollen));
   abAppend(&ab, seq, strlen(seq));
+  l->cursorcol = poscol + pcollen;
+  l->rowsbelow = 0;
   if (write(fd, ab.b, ab.len) == -1) {
   } /* Can't recover from write error. */
   abFree(&ab);
@@ -706,7 +1196,8 @@ static void refreshSingleLine(struct linenoiseState *l) {
 static void refreshMultiLine(struct linenoiseState *l) {
   char seq[64];
   size_t pcollen = promptTextColumnLen(l->prompt, strlen(l->prompt));
-  int colpos = columnPosForMultiLine(l->buf, l->len, l->len, l->cols, pcollen);
+  const char *text = gbText(l);
+  int colpos = columnPosForMultiLine(text, l->len, l->len, l->cols, pcollen);
   int colpos2; /* cursor column position. */
   int rows = (pcollen + colpos + l->cols - 1) /
              l->cols; /* rows used by current buf. */
@@ -745,13 +1236,13 @@ static void refreshMultiLine(struct linenoiseState *l) {
 
   /* Write the prompt and the current buffer content */
   abAppend(&ab, l->prompt, strlen(l->prompt));
-  abAppend(&ab, l->buf, l->len);
+  abAppendText(&ab, text, l->len);
 
   /* Show hits if any. */
   refreshShowHints(&ab, l, pcollen);
 
   /* Get column length to cursor position */
-  colpos2 = columnPosForMultiLine(l->buf, l->len, l->pos, l->cols, pcollen);
+  colpos2 = columnPosForMultiLine(text, l->len, l->pos, l->cols, pcollen);
 
   /* If we are at the very end of the screen with our prompt, we need to
    * emit a newline and move the prompt to the first column. */
@@ -788,6 +1279,8 @@ static void refreshMultiLine(struct linenoiseState *l) {
 
   lndebug("\n");
   l->oldcolpos = colpos2;
+  l->cursorcol = col;
+  l->rowsbelow = rows - rpos2;
 
   if (write(fd, ab.b, ab.len) == -1) {
   } /* Can't recover from write error. */
@@ -796,44 +1289,44 @@ static void refreshMultiLine(struct linenoiseState *l) {
 
 /* Calls the two low level functions refreshSingleLine() or
  * refreshMultiLine() according to the selected mode. */
-static void refreshLine(struct linenoiseState *l) {
+static void refreshLineNow(struct linenoiseState *l) {
+  l->needrefresh = 0;
   if (mlmode)
     refreshMultiLine(l);
   else
     refreshSingleLine(l);
 }
 
+/* Like refreshLineNow(), but when more input has already been read the
+ * redraw is deferred until it has all been handled, so a burst of
+ * keys only redraws the line once. */
+static void refreshLine(struct linenoiseState *l) {
+  if (inputPending())
+    l->needrefresh = 1;
+  else
+    refreshLineNow(l);
+}
+
 /* Insert the character 'c' at cursor current position.
  *
- * On error writing to the terminal -1 is returned, otherwise 0. */
+ * On error growing the buffer or writing to the terminal -1 is
+ * returned, otherwise 0. */
 int linenoiseEditInsert(struct linenoiseState *l, const char *cbuf, int clen) {
-  if (l->len + clen <= l->buflen) {
-    if (l->len == l->pos) {
-      memcpy(&l->buf[l->pos], cbuf, clen);
-      l->pos += clen;
-      l->len += clen;
-      ;
-      l->buf[l->len] = '\0';
-      if ((!mlmode &&
-           promptTextColumnLen(l->prompt, l->plen) +
-                   columnPos(l->buf, l->len, l->len) <
-               l->cols &&
-           !hintsCallback)) {
-        /* Avoid a full update of the line in the
-         * trivial case. */
-        if (write(l->ofd, cbuf, clen) == -1)
-          return -1;
-      } else {
-        refreshLine(l);
-      }
-    } else {
-      memmove(l->buf + l->pos + clen, l->buf + l->pos, l->len - l->pos);
-      memcpy(&l->buf[l->pos], cbuf, clen);
-      l->pos += clen;
-      l->len += clen;
-      l->buf[l->len] = '\0';
-      refreshLine(l);
-    }
+  int append = l->len == l->pos;
+
+  if (gbInsert(l, cbuf, clen) == -1)
+    return -1;
+  if (append && !mlmode && !hintsCallback && !l->needrefresh &&
+      !inputPending() &&
+      promptTextColumnLen(l->prompt, l->plen) +
+              columnPos(l->buf, l->pos, l->pos) <
+          l->cols) {
+    /* Avoid a full update of the line in the
+     * trivial case. */
+    if (write(l->ofd, cbuf, clen) == -1)
+      return -1;
+  } else {
+    refreshLine(l);
   }
   return 0;
 }
@@ -841,7 +1334,7 @@ int linenoiseEditInsert(struct linenoiseState *l, const char *cbuf, int clen) {
 /* Move cursor on the left. */
 void linenoiseEditMoveLeft(struct linenoiseState *l) {
   if (l->pos > 0) {
-    l->pos -= prevCharLen(l->buf, l->len, l->pos, NULL);
+    gbMoveTo(l, l->pos - prevCharLen(l->buf, l->pos, l->pos, NULL));
     refreshLine(l);
   }
 }
@@ -849,7 +1342,7 @@ void linenoiseEditMoveLeft(struct linenoiseState *l) {
 /* Move cursor on the right. */
 void linenoiseEditMoveRight(struct linenoiseState *l) {
   if (l->pos != l->len) {
-    l->pos += nextCharLen(l->buf, l->len, l->pos, NULL);
+    gbMoveTo(l, l->pos + nextCharLen(gbTail(l), gbTailLen(l), 0, NULL));
     refreshLine(l);
   }
 }
@@ -857,7 +1350,7 @@ void linenoiseEditMoveRight(struct linenoiseState *l) {
 /* Move cursor to the start of the line. */
 void linenoiseEditMoveHome(struct linenoiseState *l) {
   if (l->pos != 0) {
-    l->pos = 0;
+    gbMoveTo(l, 0);
     refreshLine(l);
   }
 }
@@ -865,7 +1358,7 @@ void linenoiseEditMoveHome(struct linenoiseState *l) {
 /* Move cursor to the end of the line. */
 void linenoiseEditMoveEnd(struct linenoiseState *l) {
   if (l->pos != l->len) {
-    l->pos = l->len;
+    gbMoveTo(l, l->len);
     refreshLine(l);
   }
 }
@@ -879,7 +1372,7 @@ void linenoiseEditHistoryNext(struct linenoiseState *l, int dir) {
     /* Update the current history entry before to
      * overwrite it with the next one. */
     free(history[history_len - 1 - l->history_index]);
-    history[history_len - 1 - l->history_index] = strdup(l->buf);
+    history[history_len - 1 - l->history_index] = strdup(gbText(l));
     /* Show the new entry */
     l->history_index += (dir == LINENOISE_HISTORY_PREV) ? 1 : -1;
     if (l->history_index < 0) {
@@ -889,9 +1382,7 @@ void linenoiseEditHistoryNext(struct linenoiseState *l, int dir) {
       l->history_index = history_len - 1;
       return;
     }
-    strncpy(l->buf, history[history_len - 1 - l->history_index], l->buflen);
-    l->buf[l->buflen - 1] = '\0';
-    l->len = l->pos = strlen(l->buf);
+    gbSet(l, history[history_len - 1 - l->history_index]);
     refreshLine(l);
   }
 }
@@ -900,10 +1391,8 @@ void linenoiseEditHistoryNext(struct linenoiseState *l, int dir) {
  * position. Basically this is what happens with the "Delete" keyboard key. */
 void linenoiseEditDelete(struct linenoiseState *l) {
   if (l->len > 0 && l->pos < l->len) {
-    int chlen = nextCharLen(l->buf, l->len, l->pos, NULL);
-    memmove(l->buf + l->pos, l->buf + l->pos + chlen, l->len - l->pos - chlen);
-    l->len -= chlen;
-    l->buf[l->len] = '\0';
+    /* Growing the gap past the character is enough to delete it. */
+    l->len -= nextCharLen(gbTail(l), gbTailLen(l), 0, NULL);
     refreshLine(l);
   }
 }
@@ -911,11 +1400,9 @@ void linenoiseEditDelete(struct linenoiseState *l) {
 /* Backspace implementation. */
 void linenoiseEditBackspace(struct linenoiseState *l) {
   if (l->pos > 0 && l->len > 0) {
-    int chlen = prevCharLen(l->buf, l->len, l->pos, NULL);
-    memmove(l->buf + l->pos - chlen, l->buf + l->pos, l->len - l->pos);
+    int chlen = prevCharLen(l->buf, l->pos, l->pos, NULL);
     l->pos -= chlen;
     l->len -= chlen;
-    l->buf[l->len] = '\0';
     refreshLine(l);
   }
 }
@@ -931,65 +1418,109 @@ void linenoiseEditDeletePrevWord(struct linenoiseState *l) {
   while (l->pos > 0 && l->buf[l->pos - 1] != ' ')
     l->pos--;
   diff = old_pos - l->pos;
-  memmove(l->buf + l->pos, l->buf + old_pos, l->len - old_pos + 1);
   l->len -= diff;
   refreshLine(l);
 }
 
+/* Insert a bracketed paste, reading up to the closing ESC [ 201 ~. The
+ * whole block goes into the buffer with a single redraw at the end, and
+ * pasted newlines are kept in the line instead of submitting it. If the
+ * buffer can't grow, the rest of the paste is read and dropped with a
+ * beep, so it isn't taken as typed keys.
+ *
+ * On error reading from the terminal -1 is returned, otherwise 0. */
+static int linenoiseEditPaste(struct linenoiseState *l) {
+  static const char end[] = "\x1b[201~";
+  size_t matched = 0;
+  int lastcr = 0;
+  int failed = 0;
+  char c;
+
+  while (matched < sizeof(end) - 1) {
+    if (linenoiseReadInput(l->ifd, &c, 1) != 1)
+      return -1;
+    if (c == end[matched]) {
+      matched++;
+      continue;
+    }
+    if (matched) {
+      /* Only looked like the terminator, it was pasted text. */
+      if (!failed && gbInsert(l, end, matched) == -1)
+        failed = 1;
+      matched = c == end[0];
+      if (matched)
+        continue;
+    }
+    /* Terminals send pasted newlines as carriage returns. */
+    if (c == '\n' && lastcr) {
+      lastcr = 0;
+      continue;
+    }
+    lastcr = c == '\r';
+    if (c == '\r')
+      c = '\n';
+    if (!failed && gbInsert(l, &c, 1) == -1)
+      failed = 1;
+  }
+  if (failed)
+    linenoiseBeep();
+  refreshLine(l);
+  return 0;
+}
+
 /* This function is the core of the line editing capability of linenoise.
  * It expects 'fd' to be already in "raw mode" so that every key pressed
  * will be returned ASAP to read().
  *
- * The resulting string is put into 'buf' when the user type enter, or
- * when ctrl+d is typed.
+ * The resulting string is left in the gap buffer of 'l' when the user
+ * type enter, or when ctrl+d is typed.
  *
  * The function returns the length of the current buffer. */
-static int linenoiseEdit(int stdin_fd, int stdout_fd, char *buf, size_t buflen,
+static int linenoiseEdit(struct linenoiseState *l, int stdin_fd, int stdout_fd,
                          const char *prompt) {
-  struct linenoiseState l;
-
   /* Populate the linenoise state that we pass to functions implementing
-   * specific editing functionalities. */
-  l.ifd = stdin_fd;
-  l.ofd = stdout_fd;
-  l.buf = buf;
-  l.buflen = buflen;
-  l.prompt = prompt;
-  l.plen = strlen(prompt);
-  l.oldcolpos = l.pos = 0;
-  l.len = 0;
-  l.cols = getColumns(stdin_fd, stdout_fd);
-  l.maxrows = 0;
-  l.history_index = 0;
-
-  /* Buffer starts empty. */
-  l.buf[0] = '\0';
-  l.buflen--; /* Make sure there is always space for the nulterm */
+   * specific editing functionalities. The line buffer itself is set up
+   * by the caller with gbInit() and starts empty. */
+  l->ifd = stdin_fd;
+  l->ofd = stdout_fd;
+  l->prompt = prompt;
+  l->plen = strlen(prompt);
+  l->oldcolpos = 0;
+  l->cols = getColumns(stdin_fd, stdout_fd);
+  l->maxrows = 0;
+  l->history_index = 0;
+  l->needrefresh = 0;
 
   /* The latest history entry is always our current buffer, that
    * initially is just an empty string. */
   linenoiseHistoryAdd("");
 
-  if (write(l.ofd, prompt, l.plen) == -1)
+  if (write(l->ofd, prompt, l->plen) == -1)
     return -1;
   while (1) {
     int c;
     char cbuf[32]; // large enough for any encoding?
     int nread;
-    char seq[3];
+    char seq[2];
 
-    nread = readCode(l.ifd, cbuf, sizeof(cbuf), &c);
+    /* Draw anything deferred before waiting for more input. */
+    if (l->needrefresh && !inputPending())
+      refreshLineNow(l);
+    if (eventHook != NULL && !inputPending())
+      waitForInput(l->ifd);
+
+    nread = readCode(l->ifd, cbuf, sizeof(cbuf), &c);
     if (nread <= 0)
-      return l.len;
+      return l->len;
 
     /* Only autocomplete when the callback is set. It returns < 0 when
      * there was an error reading from fd. Otherwise it will return the
      * character that should be handled next. */
     if (c == 9 && completionCallback != NULL) {
-      nread = completeLine(&l, cbuf, sizeof(cbuf), &c);
+      nread = completeLine(l, cbuf, sizeof(cbuf), &c);
       /* Return on errors */
       if (c < 0)
-        return l.len;
+        return l->len;
       /* Read next character when 0 */
       if (c == 0)
         continue;
@@ -1000,27 +1531,29 @@ static int linenoiseEdit(int stdin_fd, int stdout_fd, char *buf, size_t buflen,
       history_len--;
       free(history[history_len]);
       if (mlmode)
-        linenoiseEditMoveEnd(&l);
+        linenoiseEditMoveEnd(l);
       if (hintsCallback) {
         /* Force a refresh without hints to leave the previous
          * line as the user typed it after a newline. */
         linenoiseHintsCallback *hc = hintsCallback;
         hintsCallback = NULL;
-        refreshLine(&l);
+        refreshLineNow(l);
         hintsCallback = hc;
+      } else if (l->needrefresh) {
+        refreshLineNow(l);
       }
-      return (int)l.len;
+      return (int)l->len;
     case CTRL_C: /* ctrl-c */
       errno = EAGAIN;
       return -1;
     case BACKSPACE: /* backspace */
     case 8:         /* ctrl-h */
-      linenoiseEditBackspace(&l);
+      linenoiseEditBackspace(l);
       break;
     case CTRL_D: /* ctrl-d, remove char at right of cursor, or if the
                     line is empty, act as end-of-file. */
-      if (l.len > 0) {
-        linenoiseEditDelete(&l);
+      if (l->len > 0) {
+        linenoiseEditDelete(l);
       } else {
         history_len--;
         free(history[history_len]);
@@ -1028,68 +1561,75 @@ static int linenoiseEdit(int stdin_fd, int stdout_fd, char *buf, size_t buflen,
       }
       break;
     case CTRL_T: /* ctrl-t, swaps current character with previous. */
-      if (l.pos > 0 && l.pos < l.len) {
-        int aux = buf[l.pos - 1];
-        buf[l.pos - 1] = buf[l.pos];
-        buf[l.pos] = aux;
-        if (l.pos != l.len - 1)
-          l.pos++;
-        refreshLine(&l);
+      if (l->pos > 0 && l->pos < l->len) {
+        char *tail = gbTail(l);
+        int aux = l->buf[l->pos - 1];
+        l->buf[l->pos - 1] = tail[0];
+        tail[0] = aux;
+        if (l->pos != l->len - 1)
+          gbMoveTo(l, l->pos + 1);
+        refreshLine(l);
       }
       break;
     case CTRL_B: /* ctrl-b */
-      linenoiseEditMoveLeft(&l);
+      linenoiseEditMoveLeft(l);
       break;
     case CTRL_F: /* ctrl-f */
-      linenoiseEditMoveRight(&l);
+      linenoiseEditMoveRight(l);
       break;
     case CTRL_P: /* ctrl-p */
-      linenoiseEditHistoryNext(&l, LINENOISE_HISTORY_PREV);
+      linenoiseEditHistoryNext(l, LINENOISE_HISTORY_PREV);
       break;
     case CTRL_N: /* ctrl-n */
-      linenoiseEditHistoryNext(&l, LINENOISE_HISTORY_NEXT);
+      linenoiseEditHistoryNext(l, LINENOISE_HISTORY_NEXT);
       break;
     case ESC: /* escape sequence */
-      /* Read the next two bytes representing the escape sequence.
-       * Use two calls to handle slow terminals returning the two
-       * chars at different times. */
-      if (read(l.ifd, seq, 1) == -1)
-        break;
-      if (read(l.ifd, seq + 1, 1) == -1)
+      /* Read the next two bytes representing the escape sequence. */
+      if (linenoiseReadInput(l->ifd, seq, 2) != 2)
         break;
 
       /* ESC [ sequences. */
       if (seq[0] == '[') {
         if (seq[1] >= '0' && seq[1] <= '9') {
-          /* Extended escape, read additional byte. */
-          if (read(l.ifd, seq + 2, 1) == -1)
-            break;
-          if (seq[2] == '~') {
-            switch (seq[1]) {
-            case '3': /* Delete key. */
-              linenoiseEditDelete(&l);
+          /* Extended escape, read the remaining digits and the final
+           * byte. */
+          int code = seq[1] - '0';
+          char final = 0;
+          while (linenoiseReadInput(l->ifd, &final, 1) == 1 &&
+                 final >= '0' && final <= '9') {
+            if (code < 10000)
+              code = code * 10 + (final - '0');
+          }
+          if (final == '~') {
+            switch (code) {
+            case 3: /* Delete key. */
+              linenoiseEditDelete(l);
+              break;
+            case 200: /* Start of a bracketed paste. */
+              if (linenoiseEditPaste(l) == -1)
+                return l->len;
               break;
             }
           }
         } else {
           switch (seq[1]) {
           case 'A': /* Up */
-            linenoiseEditHistoryNext(&l, LINENOISE_HISTORY_PREV);
+            linenoiseEditHistoryNext(l, LINENOISE_HISTORY_PREV);
             break;
           case 'B': /* Down */
-            linenoiseEditHistoryNext(&l, LINENOISE_HISTORY_NEXT);
+            linenoiseEditHistoryNext(l, LINENOISE_HISTORY_NEXT);
             break;
           case 'C': /* Right */
-            linenoiseEditMoveRight(&l);
+            linenoiseEditMoveRight(l);
             break;
           case 'D': /* Left */
-            linenoiseEditMoveLeft(&l);
+            linenoiseEditMoveLeft(l);
             break;
           case 'H': /* Home */
-            linenoiseEditMoveHome(&l);
+            linenoiseEditMoveHome(l);
             break;
           case 'F': /* End*/
-            linenoiseEditMoveEnd(&l);
+            linenoiseEditMoveEnd(l);
             break;
           }
         }
@@ -1099,44 +1639,42 @@ static int linenoiseEdit(int stdin_fd, int stdout_fd, char *buf, size_t buflen,
       else if (seq[0] == 'O') {
         switch (seq[1]) {
         case 'H': /* Home */
-          linenoiseEditMoveHome(&l);
+          linenoiseEditMoveHome(l);
           break;
         case 'F': /* End*/
-          linenoiseEditMoveEnd(&l);
+          linenoiseEditMoveEnd(l);
           break;
         }
       }
       break;
     default:
-      if (linenoiseEditInsert(&l, cbuf, nread))
+      if (linenoiseEditInsert(l, cbuf, nread))
         return -1;
       break;
     case CTRL_U: /* Ctrl+u, delete the whole line. */
-      buf[0] = '\0';
-      l.pos = l.len = 0;
-      refreshLine(&l);
+      l->pos = l->len = 0;
+      refreshLine(l);
       break;
     case CTRL_K: /* Ctrl+k, delete from current to end of line. */
-      buf[l.pos] = '\0';
-      l.len = l.pos;
-      refreshLine(&l);
+      l->len = l->pos;
+      refreshLine(l);
       break;
     case CTRL_A: /* Ctrl+a, go to the start of the line */
-      linenoiseEditMoveHome(&l);
+      linenoiseEditMoveHome(l);
       break;
     case CTRL_E: /* ctrl+e, go to the end of the line */
-      linenoiseEditMoveEnd(&l);
+      linenoiseEditMoveEnd(l);
       break;
     case CTRL_L: /* ctrl+l, clear screen */
       linenoiseClearScreen();
-      refreshLine(&l);
+      refreshLine(l);
       break;
     case CTRL_W: /* ctrl+w, delete previous word */
-      linenoiseEditDeletePrevWord(&l);
+      linenoiseEditDeletePrevWord(l);
       break;
     }
   }
-  return l.len;
+  return l->len;
 }
 
 /* This special mode is used by linenoise in order to print scan codes
@@ -1171,28 +1709,39 @@ void linenoisePrintKeyCodes(void) {
 }
 
 /* This function calls the line editing function linenoiseEdit() using
- * the STDIN file descriptor set in raw mode. */
-static int linenoiseRaw(char *buf, size_t buflen, const char *prompt) {
+ * the STDIN file descriptor set in raw mode. The returned line is heap
+ * allocated, or NULL on error or end of file. */
+static char *linenoiseRaw(const char *prompt) {
+  struct linenoiseState l;
   int count;
 
-  if (buflen == 0) {
-    errno = EINVAL;
-    return -1;
+  if (gbInit(&l) == -1) {
+    errno = ENOMEM;
+    return NULL;
   }
-
-  if (enableRawMode(STDIN_FILENO) == -1)
-    return -1;
-  count = linenoiseEdit(STDIN_FILENO, STDOUT_FILENO, buf, buflen, prompt);
+  if (enableRawMode(STDIN_FILENO) == -1) {
+    gbFree(&l);
+    return NULL;
+  }
+  activeState = &l;
+  count = linenoiseEdit(&l, STDIN_FILENO, STDOUT_FILENO, prompt);
+  activeState = NULL;
+  free(activePrompt);
+  activePrompt = NULL;
   disableRawMode(STDIN_FILENO);
   printf("\n");
-  return count;
+  if (count == -1) {
+    gbFree(&l);
+    return NULL;
+  }
+  free(l.view);
+  return gbFinish(&l);
 }
 
 /* This function is called when linenoise() is called with the standard
  * input file descriptor not attached to a TTY. So for example when the
  * program using linenoise is called in pipe or with a file redirected
- * to its standard input. In this case, we want to be able to return the
- * line regardless of its length (by default we are limited to 4k). */
+ * to its standard input. It is also used for unsupported terminals. */
 static char *linenoiseNoTTY(void) {
   char *line = NULL;
   size_t len = 0, maxlen = 0;
@@ -1232,31 +1781,26 @@ static char *linenoiseNoTTY(void) {
  * editing function or uses dummy fgets() so that you will be able to type
  * something even in the most desperate of the conditions. */
 char *linenoise(const char *prompt) {
-  char buf[LINENOISE_MAX_LINE];
-  int count;
-
   if (!isatty(STDIN_FILENO)) {
-    /* Not a tty: read from file / pipe. In this mode we don't want any
-     * limit to the line size, so we call a function to handle that. */
+    /* Not a tty: read from file / pipe. */
     return linenoiseNoTTY();
   } else if (isUnsupportedTerm()) {
+    char *line;
     size_t len;
 
     printf("%s", prompt);
     fflush(stdout);
-    if (fgets(buf, LINENOISE_MAX_LINE, stdin) == NULL)
+    line = linenoiseNoTTY();
+    if (line == NULL)
       return NULL;
-    len = strlen(buf);
-    while (len && (buf[len - 1] == '\n' || buf[len - 1] == '\r')) {
+    len = strlen(line);
+    while (len && line[len - 1] == '\r') {
       len--;
-      buf[len] = '\0';
+      line[len] = '\0';
     }
-    return strdup(buf);
+    return line;
   } else {
-    count = linenoiseRaw(buf, LINENOISE_MAX_LINE, prompt);
-    if (count == -1)
-      return NULL;
-    return strdup(buf);
+    return linenoiseRaw(prompt);
   }
 }
 
@@ -1380,12 +1924,13 @@ int linenoiseHistorySave(const char *filename) {
  * on error -1 is returned. */
 int linenoiseHistoryLoad(const char *filename) {
   FILE *fp = fopen(filename, "r");
-  char buf[LINENOISE_MAX_LINE];
+  char *buf = NULL;
+  size_t buflen = 0;
 
   if (fp == NULL)
     return -1;
 
-  while (fgets(buf, LINENOISE_MAX_LINE, fp) != NULL) {
+  while (getline(&buf, &buflen, fp) != -1) {
     char *p;
 
     p = strchr(buf, '\r');
@@ -1395,6 +1940,7 @@ int linenoiseHistoryLoad(const char *filename) {
       *p = '\0';
     linenoiseHistoryAdd(buf);
   }
+  free(buf);
   fclose(fp);
   return 0;
 }
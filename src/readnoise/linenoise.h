@@ -44,17 +44,27 @@ extern "C" {
 #endif
 
 typedef struct linenoiseCompletions {
-  size_t len;
-  char **cvec;
+  size_t len;   /* Number of candidates. */
+  size_t cap;   /* Capacity of offs. */
+  size_t *offs; /* Offset of each candidate in arena. */
+  char *arena;  /* Candidates, NUL terminated, back to back. */
+  size_t used;  /* Bytes of arena in use. */
+  size_t size;  /* Allocated size of arena. */
 } linenoiseCompletions;
 
 typedef void(linenoiseCompletionCallback)(const char *, linenoiseCompletions *);
 typedef char *(linenoiseHintsCallback)(const char *, int *color, int *bold);
 typedef void(linenoiseFreeHintsCallback)(void *);
+typedef int(linenoiseEventHook)(void);
 void linenoiseSetCompletionCallback(linenoiseCompletionCallback *);
 void linenoiseSetHintsCallback(linenoiseHintsCallback *);
 void linenoiseSetFreeHintsCallback(linenoiseFreeHintsCallback *);
+void linenoiseSetEventHook(linenoiseEventHook *);
+void linenoiseSetPrompt(const char *prompt);
+void linenoiseRefreshLine(void);
 void linenoiseAddCompletion(linenoiseCompletions *, const char *);
+void linenoiseAddCompletionPrefixed(linenoiseCompletions *, const char *prefix,
+                                    size_t plen, const char *str, size_t len);
 
 char *linenoise(const char *prompt);
 int linenoiseHistoryAdd(const char *line);
@@ -71,6 +81,8 @@ typedef size_t(linenoiseNextCharLen)(const char *buf, size_t buf_len,
                                      size_t pos, size_t *col_len);
 typedef size_t(linenoiseReadCode)(int fd, char *buf, size_t buf_len, int *c);
 
+int linenoiseReadInput(int fd, char *buf, size_t len);
+
 void linenoiseSetEncodingFunctions(linenoisePrevCharLen *prevCharLenFunc,
                                    linenoiseNextCharLen *nextCharLenFunc,
                                    linenoiseReadCode *readCodeFunc);
@@ -9,6 +9,7 @@ rl_completion_func_t *rl_attempted_completion_function = NULL;
 int rl_attempted_completion_over = 0;
 int rl_completion_append_character = 0;
 char *rl_line_buffer = 0;
+rl_hook_func_t *rl_event_hook = NULL;
 
 static void completion(const char *buf, linenoiseCompletions *lc) {
   if (!rl_attempted_completion_function)
@@ -30,27 +31,32 @@ static void completion(const char *buf, linenoiseCompletions *lc) {
 
   char **matches = rl_attempted_completion_function(buf + start, start, len);
   if (matches) {
+    // matches[0] is the common prefix readline would substitute, the
+    // candidates follow it, unless it is the only match.
+    int first = matches[0] && matches[1] ? 1 : 0;
     for (int i = 0; matches[i]; i++) {
-      // Add completion...
-      size_t match_len = strlen(matches[i]);
-      size_t completion_len = start + match_len;
-      char *completion = malloc(completion_len + 1);
-      if (!completion)
-        abort();
-
-      memcpy(completion, buf, start);
-      memcpy(completion + start, matches[i], match_len);
-      completion[completion_len] = 0;
-      linenoiseAddCompletion(lc, completion);
-      free(completion);
+      if (i >= first)
+        linenoiseAddCompletionPrefixed(lc, buf, start, matches[i],
+                                       strlen(matches[i]));
       free(matches[i]);
     }
     free(matches);
   }
 }
 
+int rl_set_prompt(const char *prompt) {
+  linenoiseSetPrompt(prompt);
+  return 0;
+}
+
+int rl_forced_update_display(void) {
+  linenoiseRefreshLine();
+  return 0;
+}
+
 char *readline(const char *prompt) {
   linenoiseSetCompletionCallback(completion);
+  linenoiseSetEventHook(rl_event_hook);
   rl_attempted_completion_over = 0;
   return linenoise(prompt);
 }
@@ -7,4 +7,11 @@ extern int rl_attempted_completion_over;
 extern int rl_completion_append_character;
 extern char *rl_line_buffer;
 
+typedef int rl_hook_func_t(void);
+
+extern rl_hook_func_t *rl_event_hook;
+
+int rl_set_prompt(const char *prompt);
+int rl_forced_update_display(void);
+
 char *readline(const char *prompt);
@@ -43,6 +43,7 @@
 
 #include <unistd.h>
 #include <stdio.h>
+#include "linenoise.h"
 
 #define UNUSED(x) (void)(x)
 
@@ -435,7 +436,7 @@ size_t linenoiseUtf8PrevCharLen(const char *buf, size_t buf_len, size_t pos,
 size_t linenoiseUtf8ReadCode(int fd, char *buf, size_t buf_len, int *cp) {
   if (buf_len < 1)
     return -1;
-  size_t nread = read(fd, &buf[0], 1);
+  size_t nread = linenoiseReadInput(fd, &buf[0], 1);
   if (nread <= 0)
     return nread;
 
@@ -445,19 +446,19 @@ size_t linenoiseUtf8ReadCode(int fd, char *buf, size_t buf_len, int *cp) {
   } else if ((byte & 0xE0) == 0xC0) {
     if (buf_len < 2)
       return -1;
-    nread = read(fd, &buf[1], 1);
+    nread = linenoiseReadInput(fd, &buf[1], 1);
     if (nread <= 0)
       return nread;
   } else if ((byte & 0xF0) == 0xE0) {
     if (buf_len < 3)
       return -1;
-    nread = read(fd, &buf[1], 2);
+    nread = linenoiseReadInput(fd, &buf[1], 2);
     if (nread <= 0)
       return nread;
   } else if ((byte & 0xF8) == 0xF0) {
     if (buf_len < 3)
       return -1;
-    nread = read(fd, &buf[1], 3);
+    nread = linenoiseReadInput(fd, &buf[1], 3);
     if (nread <= 0)
       return nread;
   } else {
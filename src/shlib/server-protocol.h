@@ -0,0 +1,24 @@
+// Protocol between janetsh -server and janetsh-client over a unix
+// socket.
+//
+// The client sends a ServerRequest with its stdin, stdout and stderr
+// attached as SCM_RIGHTS, followed by len bytes of NUL terminated
+// strings: the working directory, nargs arguments (the script and its
+// arguments) and nenv environment entries. The server replies with the
+// pid running the script as an int32_t, so the client can forward
+// signals to it, and then its exit code as an int32_t, 128 plus the
+// signal number if it was killed.
+#ifndef JANETSH_SERVER_PROTOCOL_H
+#define JANETSH_SERVER_PROTOCOL_H
+
+#include <stdint.h>
+
+#define SERVER_MAX_REQUEST (16 * 1024 * 1024)
+
+typedef struct {
+  uint32_t nargs;
+  uint32_t nenv;
+  uint32_t len;
+} ServerRequest;
+
+#endif
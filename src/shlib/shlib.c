@@ -1,4 +1,6 @@
 #define _DEFAULT_SOURCE
+// For memfd_create.
+#define _GNU_SOURCE
 #include <janet.h>
 #include <unistd.h>
 #include <assert.h>
@@ -9,12 +11,22 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#if defined(__GLIBC__) || defined(__linux__)
+#include <stdio_ext.h>
+#endif
 #include <fcntl.h>
 #include <glob.h>
+#include <poll.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <readline.h>
 #ifndef SHLIB_NO_HISTORY_INCLUDE
 #include <history.h>
 #endif
+#include "server-protocol.h"
 
 #define panic_errno(NAME, e)                                                   \
   do {                                                                         \
@@ -127,6 +139,27 @@ static Janet pipe_(int32_t argc, Janet *argv) {
   return janet_wrap_tuple(janet_tuple_end(t));
 }
 
+static Janet read_(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 3);
+  int fd = janet_getinteger(argv, 0);
+  JanetBuffer *buf = janet_getbuffer(argv, 1);
+  int32_t n = janet_getinteger(argv, 2);
+  if (n < 0)
+    janet_panic("read: expected a non negative count");
+  janet_buffer_ensure(buf, buf->count + n, 2);
+  ssize_t r;
+  do {
+    r = read(fd, buf->data + buf->count, n);
+  } while (r == -1 && errno == EINTR);
+  // Nothing to read yet from a non blocking fd.
+  if (r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    return janet_wrap_nil();
+  if (r == -1)
+    panic_errno("read", errno);
+  buf->count += r;
+  return janet_wrap_integer(r);
+}
+
 static Janet open_(int32_t argc, Janet *argv) {
   janet_fixarity(argc, 3);
   int fd = open(janet_getcstring(argv, 0), janet_getinteger(argv, 1),
@@ -137,6 +170,35 @@ static Janet open_(int32_t argc, Janet *argv) {
   return janet_wrap_integer(fd);
 }
 
+static Janet chmod_(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+  if (chmod(janet_getcstring(argv, 0), janet_getinteger(argv, 1)) == -1)
+    panic_errno("chmod", errno);
+  return janet_wrap_nil();
+}
+
+static Janet fchmod_(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+  if (fchmod(janet_getinteger(argv, 0), janet_getinteger(argv, 1)) == -1)
+    panic_errno("fchmod", errno);
+  return janet_wrap_nil();
+}
+
+static Janet cloexec(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+  int fd = janet_getinteger(argv, 0);
+  int flags = fcntl(fd, F_GETFD);
+  if (flags == -1)
+    panic_errno("cloexec", errno);
+  if (janet_truthy(argv[1]))
+    flags |= FD_CLOEXEC;
+  else
+    flags &= ~FD_CLOEXEC;
+  if (fcntl(fd, F_SETFD, flags) == -1)
+    panic_errno("cloexec", errno);
+  return janet_wrap_nil();
+}
+
 static Janet close_(int32_t argc, Janet *argv) {
   janet_fixarity(argc, 1);
   if (close((int)janet_getnumber(argv, 0)) == -1)
@@ -403,6 +465,137 @@ static Janet set_noninteractive_signal_handlers(int32_t argc, Janet *argv) {
   return janet_wrap_nil();
 }
 
+// Fuzzy matching
+//
+// A candidate matches when the pattern is a subsequence of it. Matching
+// ignores case unless the pattern has an upper case letter. Candidates
+// are first checked with memchr, which libc vectorizes, so rejecting the
+// bulk of a large candidate set costs little more than scanning memory.
+// Only the survivors are scored.
+
+static const uint8_t *fuzzy_find(const uint8_t *s, size_t n, uint8_t c,
+                                 int icase) {
+  const uint8_t *p = memchr(s, c, n);
+  if (icase && c >= 'a' && c <= 'z') {
+    const uint8_t *q = memchr(s, c - 'a' + 'A', p ? (size_t)(p - s) : n);
+    if (q)
+      p = q;
+  }
+  return p;
+}
+
+static int fuzzy_eq(uint8_t c, uint8_t pc, int icase) {
+  if (icase && c >= 'A' && c <= 'Z')
+    c = c - 'A' + 'a';
+  return c == pc;
+}
+
+static int fuzzy_is_sep(uint8_t c) {
+  return c == '/' || c == '-' || c == '_' || c == '.' || c == ' ';
+}
+
+// Score s against pat, returning 0 when it does not match. The match
+// found first is narrowed to the shortest window ending at the same
+// place, then scored for matches at word starts, runs of consecutive
+// matches and gaps.
+static int32_t fuzzy_score(const uint8_t *s, size_t n, const uint8_t *pat,
+                           size_t m, int icase) {
+  size_t pos = 0, start, end, i, j;
+  int32_t score = 1, run = 0;
+
+  for (j = 0; j < m; j++) {
+    const uint8_t *p = fuzzy_find(s + pos, n - pos, pat[j], icase);
+    if (!p)
+      return 0;
+    pos = p - s + 1;
+  }
+  if (m == 0)
+    return score;
+
+  end = pos - 1;
+  start = end;
+  j = m;
+  for (i = end + 1; i-- > 0;) {
+    if (fuzzy_eq(s[i], pat[j - 1], icase) && --j == 0) {
+      start = i;
+      break;
+    }
+  }
+
+  for (i = start, j = 0; i <= end; i++) {
+    if (j < m && fuzzy_eq(s[i], pat[j], icase)) {
+      score += 16;
+      if (i == 0)
+        score += 10;
+      else if (fuzzy_is_sep(s[i - 1]))
+        score += 8;
+      else if (s[i - 1] >= 'a' && s[i - 1] <= 'z' && s[i] >= 'A' &&
+               s[i] <= 'Z')
+        score += 7;
+      score += 4 * run;
+      run++;
+      j++;
+    } else {
+      score -= run ? 3 : 1;
+      run = 0;
+    }
+  }
+  return score > 0 ? score : 1;
+}
+
+typedef struct {
+  int32_t score;
+  int32_t len;
+  int32_t idx;
+} FuzzyHit;
+
+static int fuzzy_hit_cmp(const void *a, const void *b) {
+  const FuzzyHit *x = a, *y = b;
+  if (x->score != y->score)
+    return x->score > y->score ? -1 : 1;
+  if (x->len != y->len)
+    return x->len < y->len ? -1 : 1;
+  return x->idx < y->idx ? -1 : x->idx > y->idx;
+}
+
+static Janet fuzzy_match(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+  JanetByteView pat = janet_getbytes(argv, 0);
+  JanetView cands = janet_getindexed(argv, 1);
+
+  int icase = 1;
+  for (int32_t i = 0; i < pat.len; i++)
+    if (pat.bytes[i] >= 'A' && pat.bytes[i] <= 'Z')
+      icase = 0;
+
+  FuzzyHit *hits = malloc(sizeof(FuzzyHit) * (cands.len ? cands.len : 1));
+  if (!hits)
+    abort();
+
+  int32_t nhits = 0;
+  for (int32_t i = 0; i < cands.len; i++) {
+    const uint8_t *s;
+    int32_t len;
+    if (!janet_bytes_view(cands.items[i], &s, &len))
+      continue;
+    int32_t score = fuzzy_score(s, len, pat.bytes, pat.len, icase);
+    if (score) {
+      hits[nhits].score = score;
+      hits[nhits].len = len;
+      hits[nhits].idx = i;
+      nhits++;
+    }
+  }
+
+  qsort(hits, nhits, sizeof(FuzzyHit), fuzzy_hit_cmp);
+
+  JanetArray *a = janet_array(nhits);
+  for (int32_t i = 0; i < nhits; i++)
+    janet_array_push(a, cands.items[hits[i].idx]);
+  free(hits);
+  return janet_wrap_array(a);
+}
+
 static char *longest_common_prefix(char **strs, int n) {
   int shortest_len = -1;
   char *shortest_str = NULL;
@@ -502,6 +695,14 @@ static char **shlib_readline_attempted_completion(const char *text, int start,
 
   if (rlcompletions) {
     char *pfx = longest_common_prefix(rlcompletions + 1, nrlcompletions);
+    // Fuzzy matches need not start with the text, in which case their
+    // common prefix would replace what was typed with less of it.
+    if (nrlcompletions > 1 && strncmp(pfx, text, strlen(text)) != 0) {
+      free(pfx);
+      pfx = strdup(text);
+      if (!pfx)
+        abort();
+    }
     rlcompletions[0] = pfx;
   }
 
@@ -510,13 +711,32 @@ static char **shlib_readline_attempted_completion(const char *text, int start,
   return rlcompletions;
 }
 
+// Called by readline about ten times a second while waiting for a key.
+// When the Janet event function returns a string, it becomes the
+// prompt and the line is redrawn in place.
+static JanetFunction *event_janet_function = NULL;
+static int shlib_readline_event_hook(void) {
+  if (!event_janet_function)
+    return 0;
+
+  Janet prompt = janet_wrap_nil();
+  JanetFiber *fiber = NULL;
+  JanetSignal status =
+      janet_pcall(event_janet_function, 0, NULL, &prompt, &fiber);
+  if (status == JANET_SIGNAL_OK && janet_checktype(prompt, JANET_STRING)) {
+    rl_set_prompt((const char *)janet_unwrap_string(prompt));
+    rl_forced_update_display();
+  }
+  return 0;
+}
+
 static Janet input_readline(int32_t argc, Janet *argv) {
   static int recursion = 0;
   if (recursion)
     janet_panic("readline cannot be called from readline!");
   recursion = 1;
 
-  janet_fixarity(argc, 2);
+  janet_arity(argc, 2, 3);
 
   Janet ret = janet_wrap_nil();
 
@@ -524,7 +744,13 @@ static Janet input_readline(int32_t argc, Janet *argv) {
 
   const char *prompt = janet_getcstring(argv, 0);
   completion_janet_function = janet_getfunction(argv, 1);
+  event_janet_function = NULL;
+  if (argc == 3 && !janet_checktype(argv[2], JANET_NIL))
+    event_janet_function = janet_getfunction(argv, 2);
+  rl_event_hook = event_janet_function ? shlib_readline_event_hook : NULL;
   char *ln = readline(prompt);
+  rl_event_hook = NULL;
+  event_janet_function = NULL;
   if (ln) {
     if (*ln)
       add_history(ln);
@@ -550,6 +776,1110 @@ static Janet input_history_load(int32_t argc, Janet *argv) {
   return janet_wrap_nil();
 }
 
+static int write_all(int fd, const uint8_t *buf, size_t n) {
+  while (n) {
+    ssize_t w = write(fd, buf, n);
+    if (w == -1) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    buf += w;
+    n -= w;
+  }
+  return 0;
+}
+
+static Janet write_(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+  int fd = janet_getinteger(argv, 0);
+  JanetByteView data = janet_getbytes(argv, 1);
+  if (write_all(fd, data.bytes, data.len) == -1)
+    panic_errno("write", errno);
+  return janet_wrap_nil();
+}
+
+// The child side of call-in-child and call-in-background. Calls f and
+// writes its result to fd, then exits with _exit so the child never runs
+// the atexit handlers that restore the terminal or clean up jobs. An
+// array of strings is written NUL separated, a string or buffer as is.
+static void call_and_exit(JanetFunction *f, int fd) {
+  Janet out;
+  JanetFiber *fiber = NULL;
+  if (janet_pcall(f, 0, NULL, &out, &fiber) != JANET_SIGNAL_OK)
+    _exit(1);
+  if (janet_checktype(out, JANET_ARRAY)) {
+    JanetArray *a = janet_unwrap_array(out);
+    for (int32_t i = 0; i < a->count; i++) {
+      if (!janet_checktype(a->data[i], JANET_STRING))
+        continue;
+      const uint8_t *s = janet_unwrap_string(a->data[i]);
+      size_t len = janet_string_length(s);
+      if (strlen((const char *)s) != len)
+        continue;
+      // Include the terminating NUL as a separator.
+      if (write_all(fd, s, len + 1) == -1)
+        _exit(1);
+    }
+    _exit(0);
+  }
+  const uint8_t *bytes;
+  int32_t len;
+  if (!janet_bytes_view(out, &bytes, &len) || write_all(fd, bytes, len) == -1)
+    _exit(1);
+  _exit(0);
+}
+
+// Call f in a forked child and return the strings in the array it
+// returns. While waiting, cancel-fd is watched and if it becomes
+// readable (a key was pressed) the child is killed and nil is
+// returned.
+static Janet call_in_child(int32_t argc, Janet *argv) {
+  janet_arity(argc, 1, 2);
+  JanetFunction *f = janet_getfunction(argv, 0);
+  int cancelfd = -1;
+  if (argc == 2 && !janet_checktype(argv[1], JANET_NIL))
+    cancelfd = janet_getinteger(argv, 1);
+
+  int p[2];
+  if (pipe(p) < 0)
+    panic_errno("pipe", errno);
+
+  pid_t pid = fork();
+  if (pid == -1) {
+    int e = errno;
+    close(p[0]);
+    close(p[1]);
+    panic_errno("fork", e);
+  }
+
+  if (pid == 0) {
+    close(p[0]);
+    call_and_exit(f, p[1]);
+  }
+
+  close(p[1]);
+
+  JanetBuffer *buf = janet_buffer(1024);
+  struct pollfd fds[2] = {{.fd = p[0], .events = POLLIN},
+                          {.fd = cancelfd, .events = POLLIN}};
+  int nfds = cancelfd == -1 ? 1 : 2;
+  int cancelled = 0;
+  int err = 0;
+
+  while (1) {
+    if (poll(fds, nfds, -1) == -1) {
+      if (errno == EINTR)
+        continue;
+      err = errno;
+      break;
+    }
+    if (nfds == 2 && fds[1].revents) {
+      cancelled = 1;
+      break;
+    }
+    if (fds[0].revents) {
+      janet_buffer_ensure(buf, buf->count + 4096, 2);
+      ssize_t r = read(p[0], buf->data + buf->count, 4096);
+      if (r == -1) {
+        if (errno == EINTR)
+          continue;
+        err = errno;
+        break;
+      }
+      if (r == 0)
+        break;
+      buf->count += r;
+    }
+  }
+
+  if (cancelled || err)
+    kill(pid, SIGKILL);
+  close(p[0]);
+
+  int status = 0;
+  while (waitpid(pid, &status, 0) == -1) {
+    if (errno != EINTR)
+      panic_errno("waitpid", errno);
+  }
+
+  if (err)
+    panic_errno("call-in-child", err);
+  if (cancelled)
+    return janet_wrap_nil();
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    janet_panic("call-in-child: child failed");
+
+  JanetArray *results = janet_array(0);
+  int32_t start = 0;
+  for (int32_t i = 0; i < buf->count; i++) {
+    if (buf->data[i] == 0) {
+      janet_array_push(results, janet_stringv(buf->data + start, i - start));
+      start = i + 1;
+    }
+  }
+  return janet_wrap_array(results);
+}
+
+// Fork a child that calls f and writes the string it returns to a pipe,
+// returning [pid fd] without waiting. fd is non blocking so the caller
+// can drain it while the child runs, the caller reaps the child and
+// reads and closes fd.
+static Janet call_in_background(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  JanetFunction *f = janet_getfunction(argv, 0);
+
+  int p[2];
+  if (pipe(p) < 0)
+    panic_errno("pipe", errno);
+
+  pid_t pid = fork();
+  if (pid == -1) {
+    int e = errno;
+    close(p[0]);
+    close(p[1]);
+    panic_errno("fork", e);
+  }
+
+  if (pid == 0) {
+    close(p[0]);
+    call_and_exit(f, p[1]);
+  }
+
+  close(p[1]);
+  fcntl(p[0], F_SETFL, fcntl(p[0], F_GETFL) | O_NONBLOCK);
+  Janet *t = janet_tuple_begin(2);
+  t[0] = janet_wrap_integer(pid);
+  t[1] = janet_wrap_integer(p[0]);
+  return janet_wrap_tuple(janet_tuple_end(t));
+}
+
+// In process pipeline stages
+
+// Whether the reading end of the pipe fd has been closed.
+static int pipe_reader_gone(int fd) {
+  struct pollfd p = {.fd = fd, .events = POLLOUT};
+  return poll(&p, 1, 0) == 1 && (p.revents & POLLERR);
+}
+
+// Call f with stdin and stdout temporarily replaced by infd and outfd,
+// as a pipeline stage running in the shell itself. Returns
+// [ok result broken-pipe], where broken-pipe is true if f failed or
+// its output was lost because the next stage had exited, which a
+// forked stage would have seen as SIGPIPE. The shell ignores SIGPIPE,
+// so writes fail with EPIPE instead.
+static Janet call_stage(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 3);
+  JanetFunction *f = janet_getfunction(argv, 0);
+  int infd = janet_getinteger(argv, 1);
+  int outfd = janet_getinteger(argv, 2);
+
+  fflush(stdout);
+  fflush(stderr);
+  int saved[3];
+  for (int i = 0; i < 3; i++) {
+    saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 3);
+    if (saved[i] == -1) {
+      int e = errno;
+      while (i--)
+        close(saved[i]);
+      panic_errno("call-stage", e);
+    }
+  }
+  dup2(infd, STDIN_FILENO);
+  dup2(outfd, STDOUT_FILENO);
+
+  Janet out;
+  JanetFiber *fiber = NULL;
+  int ok = janet_pcall(f, 0, NULL, &out, &fiber) == JANET_SIGNAL_OK;
+  if (fflush(stdout) != 0)
+    ok = 0;
+  fflush(stderr);
+  int broken = (!ok || ferror(stdout)) && pipe_reader_gone(STDOUT_FILENO);
+
+  for (int i = 0; i < 3; i++) {
+    dup2(saved[i], i);
+    close(saved[i]);
+  }
+  // Drop the stage's end of file and any of its input left in the
+  // buffer, so the shell's own stdin reads work as before.
+#if defined(__GLIBC__) || defined(__linux__)
+  __fpurge(stdin);
+#else
+  fpurge(stdin);
+#endif
+  clearerr(stdin);
+  clearerr(stdout);
+
+  Janet *t = janet_tuple_begin(3);
+  t[0] = janet_wrap_boolean(ok);
+  t[1] = out;
+  t[2] = janet_wrap_boolean(broken);
+  return janet_wrap_tuple(janet_tuple_end(t));
+}
+
+// Copy everything from infd to outfd, with splice when one of them is
+// a pipe so the data doesn't pass through user space.
+static Janet copy_fd(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+  int infd = janet_getinteger(argv, 0);
+  int outfd = janet_getinteger(argv, 1);
+
+#ifdef SPLICE_F_MOVE
+  for (;;) {
+    ssize_t n = splice(infd, NULL, outfd, NULL, 1 << 20, SPLICE_F_MOVE);
+    if (n == 0)
+      return janet_wrap_nil();
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      // Neither fd is a pipe, or the fds don't support splice.
+      if (errno == EINVAL)
+        break;
+      panic_errno("copy-fd", errno);
+    }
+  }
+#endif
+
+  uint8_t buf[65536];
+  for (;;) {
+    ssize_t n = read(infd, buf, sizeof(buf));
+    if (n == 0)
+      return janet_wrap_nil();
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      panic_errno("copy-fd", errno);
+    }
+    if (write_all(outfd, buf, n) == -1)
+      panic_errno("copy-fd", errno);
+  }
+}
+
+#ifdef SPLICE_F_MOVE
+// Move n bytes from the pipe infd to outfd, returning how many were
+// moved. Fewer than n means splice failed, with errno set.
+static size_t splice_all(int infd, int outfd, size_t n) {
+  size_t moved = 0;
+  while (moved < n) {
+    ssize_t m = splice(infd, NULL, outfd, NULL, n - moved, SPLICE_F_MOVE);
+    if (m == -1) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    moved += m;
+  }
+  return moved;
+}
+#endif
+
+// Copy everything from infd to outfd and to each sink fd. When outfd is
+// a pipe and there is one sink, the data is duplicated with tee and
+// moved with splice, so it never passes through user space.
+static Janet tee_fds(int32_t argc, Janet *argv) {
+  janet_arity(argc, 2, -1);
+  int infd = janet_getinteger(argv, 0);
+  int outfd = janet_getinteger(argv, 1);
+  int nsinks = argc - 2;
+  int sinks[nsinks > 0 ? nsinks : 1];
+  for (int i = 0; i < nsinks; i++)
+    sinks[i] = janet_getinteger(argv, i + 2);
+
+  uint8_t buf[65536];
+#ifdef SPLICE_F_MOVE
+  while (nsinks == 1) {
+    ssize_t n = tee(infd, outfd, 1 << 20, 0);
+    if (n == 0)
+      return janet_wrap_nil();
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      // One of the fds is not a pipe.
+      if (errno == EINVAL)
+        break;
+      panic_errno("tee-fds", errno);
+    }
+    size_t moved = splice_all(infd, sinks[0], n);
+    if (moved == (size_t)n)
+      continue;
+    if (errno != EINVAL)
+      panic_errno("tee-fds", errno);
+    // The sink can't be spliced to, for example a file opened for
+    // appending, so copy the rest of what was teed by hand and stop
+    // splicing.
+    n -= moved;
+    while (n) {
+      size_t want = (size_t)n < sizeof(buf) ? (size_t)n : sizeof(buf);
+      ssize_t r = read(infd, buf, want);
+      if (r == -1 && errno == EINTR)
+        continue;
+      if (r <= 0 || write_all(sinks[0], buf, r) == -1)
+        panic_errno("tee-fds", r == 0 ? EIO : errno);
+      n -= r;
+    }
+    break;
+  }
+#endif
+
+  for (;;) {
+    ssize_t n = read(infd, buf, sizeof(buf));
+    if (n == 0)
+      return janet_wrap_nil();
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      panic_errno("tee-fds", errno);
+    }
+    if (write_all(outfd, buf, n) == -1)
+      panic_errno("tee-fds", errno);
+    for (int i = 0; i < nsinks; i++)
+      if (write_all(sinks[i], buf, n) == -1)
+        panic_errno("tee-fds", errno);
+  }
+}
+
+// Read outfd and errfd to end of file at the same time, so a process
+// blocked writing one of them can't stall the other. Output past the
+// optional limits is read and dropped. Returns [out err].
+static Janet capture_fds(int32_t argc, Janet *argv) {
+  janet_arity(argc, 2, 4);
+  struct pollfd fds[2];
+  JanetBuffer *bufs[2];
+  int64_t limits[2];
+  for (int i = 0; i < 2; i++) {
+    fds[i].fd = janet_getinteger(argv, i);
+    fds[i].events = POLLIN;
+    bufs[i] = janet_buffer(4096);
+    limits[i] = -1;
+    if (argc > i + 2 && !janet_checktype(argv[i + 2], JANET_NIL)) {
+      limits[i] = janet_getinteger(argv, i + 2);
+      if (limits[i] < 0)
+        janet_panic("capture-fds: expected a non negative limit");
+    }
+  }
+
+  uint8_t discard[4096];
+  int nopen = 2;
+  while (nopen) {
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR)
+        continue;
+      panic_errno("capture-fds", errno);
+    }
+    for (int i = 0; i < 2; i++) {
+      if (fds[i].fd == -1 || !fds[i].revents)
+        continue;
+      JanetBuffer *buf = bufs[i];
+      int full = limits[i] >= 0 && buf->count >= limits[i];
+      size_t want = 65536;
+      if (!full && limits[i] >= 0 && limits[i] - buf->count < (int64_t)want)
+        want = limits[i] - buf->count;
+      uint8_t *dst = discard;
+      if (full) {
+        want = sizeof(discard);
+      } else {
+        janet_buffer_ensure(buf, buf->count + want, 2);
+        dst = buf->data + buf->count;
+      }
+      ssize_t r = read(fds[i].fd, dst, want);
+      if (r == -1) {
+        if (errno == EINTR)
+          continue;
+        panic_errno("capture-fds", errno);
+      }
+      if (r == 0) {
+        // poll ignores negative fds.
+        fds[i].fd = -1;
+        nopen--;
+      } else if (!full) {
+        buf->count += r;
+      }
+    }
+  }
+
+  Janet *t = janet_tuple_begin(2);
+  t[0] = janet_stringv(bufs[0]->data, bufs[0]->count);
+  t[1] = janet_stringv(bufs[1]->data, bufs[1]->count);
+  return janet_wrap_tuple(janet_tuple_end(t));
+}
+
+// Wait until at least one of the fds is readable or hung up,
+// returning an array of those that are.
+static Janet poll_readable(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  JanetView v = janet_getindexed(argv, 0);
+  struct pollfd fds[v.len > 0 ? v.len : 1];
+  for (int32_t i = 0; i < v.len; i++) {
+    if (!janet_checktype(v.items[i], JANET_NUMBER))
+      janet_panic("poll-readable: expected fds");
+    fds[i].fd = janet_unwrap_integer(v.items[i]);
+    fds[i].events = POLLIN;
+  }
+  while (poll(fds, v.len, -1) == -1)
+    if (errno != EINTR)
+      panic_errno("poll-readable", errno);
+  JanetArray *a = janet_array(0);
+  for (int32_t i = 0; i < v.len; i++)
+    if (fds[i].revents)
+      janet_array_push(a, janet_wrap_integer(fds[i].fd));
+  return janet_wrap_array(a);
+}
+
+// Shared memory
+//
+// A memfd created before fork is shared with the child, so the child
+// can hand back large data by writing it there and sending only its
+// length through a pipe.
+
+// Return a new memfd, or nil where memfds aren't supported.
+static Janet shm_create(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 0);
+#ifdef MFD_CLOEXEC
+  int fd = memfd_create("janetsh-shm", MFD_CLOEXEC);
+  if (fd != -1)
+    return janet_wrap_integer(fd);
+#endif
+  return janet_wrap_nil();
+}
+
+// Replace the contents of the memfd with data.
+static Janet shm_write(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+  int fd = janet_getinteger(argv, 0);
+  JanetByteView data = janet_getbytes(argv, 1);
+  if (ftruncate(fd, data.len) == -1)
+    panic_errno("shm-write", errno);
+  off_t off = 0;
+  while (off < data.len) {
+    ssize_t w = pwrite(fd, data.bytes + off, data.len - off, off);
+    if (w == -1) {
+      if (errno == EINTR)
+        continue;
+      panic_errno("shm-write", errno);
+    }
+    off += w;
+  }
+  return janet_wrap_nil();
+}
+
+// Return the first n bytes of the memfd as a buffer.
+static Janet shm_read(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+  int fd = janet_getinteger(argv, 0);
+  int32_t n = janet_getinteger(argv, 1);
+  if (n < 0)
+    janet_panic("shm-read: expected a non negative count");
+  JanetBuffer *buf = janet_buffer(n);
+  while (buf->count < n) {
+    ssize_t r = pread(fd, buf->data + buf->count, n - buf->count, buf->count);
+    if (r == -1 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      panic_errno("shm-read", r == 0 ? EIO : errno);
+    buf->count += r;
+  }
+  return janet_wrap_buffer(buf);
+}
+
+// Redirect sources
+
+// Up to this many bytes are written into a pipe, which never blocks
+// since they fit in the pipe buffer. Larger data goes into a memfd.
+#define DATA_FD_PIPE_MAX PIPE_BUF
+
+// Return a readable fd with the contents of a string or buffer, for
+// redirecting a child's stdin from janet data after fork. The data is
+// written in full before returning and nothing touches the disk.
+static Janet data_fd(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  JanetByteView data = janet_getbytes(argv, 0);
+
+#ifdef MFD_ALLOW_SEALING
+  if (data.len > DATA_FD_PIPE_MAX) {
+    int fd = memfd_create("janetsh-redirect", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd != -1) {
+      if (write_all(fd, data.bytes, data.len) == -1 ||
+          lseek(fd, 0, SEEK_SET) == -1) {
+        int e = errno;
+        close(fd);
+        panic_errno("data-fd", e);
+      }
+      fcntl(fd, F_ADD_SEALS,
+            F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+      return janet_wrap_integer(fd);
+    }
+  }
+#endif
+
+  int p[2];
+  if (pipe(p) < 0)
+    panic_errno("pipe", errno);
+  if (data.len <= DATA_FD_PIPE_MAX) {
+    if (write_all(p[1], data.bytes, data.len) == -1) {
+      int e = errno;
+      close(p[0]);
+      close(p[1]);
+      panic_errno("data-fd", e);
+    }
+    close(p[1]);
+    return janet_wrap_integer(p[0]);
+  }
+
+  // Without memfd, a detached writer feeds the pipe. The intermediate
+  // child exits at once so the writer is never left as our zombie.
+  pid_t pid = fork();
+  if (pid == -1) {
+    int e = errno;
+    close(p[0]);
+    close(p[1]);
+    panic_errno("fork", e);
+  }
+  if (pid == 0) {
+    if (fork() == 0) {
+      close(p[0]);
+      signal(SIGPIPE, SIG_DFL);
+      write_all(p[1], data.bytes, data.len);
+      _exit(0);
+    }
+    _exit(0);
+  }
+  close(p[1]);
+  int status;
+  while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+    ;
+  return janet_wrap_integer(p[0]);
+}
+
+// Splitting
+//
+// Separators are found with memchr, which libc vectorizes, and fields
+// are copied straight into janet strings.
+
+// Push the fields of [p, end) separated by sep onto a. A separator at
+// the very end doesn't start another field.
+static void push_split(JanetArray *a, const uint8_t *p, const uint8_t *end,
+                       uint8_t sep) {
+  while (p < end) {
+    const uint8_t *e = memchr(p, sep, end - p);
+    if (!e)
+      e = end;
+    janet_array_push(a, janet_stringv(p, e - p));
+    p = e + 1;
+  }
+}
+
+static int is_blank(uint8_t c) { return c == ' ' || c == '\t'; }
+
+// Push the runs of non blank characters in [p, end) onto a, like awk.
+static void push_fields(JanetArray *a, const uint8_t *p, const uint8_t *end) {
+  for (;;) {
+    while (p < end && is_blank(*p))
+      p++;
+    if (p == end)
+      return;
+    const uint8_t *e = p;
+    while (e < end && !is_blank(*e))
+      e++;
+    janet_array_push(a, janet_stringv(p, e - p));
+    p = e;
+  }
+}
+
+static uint8_t getsep(const Janet *argv, int32_t n) {
+  JanetByteView sep = janet_getbytes(argv, n);
+  if (sep.len != 1)
+    janet_panic("expected a single byte separator");
+  return sep.bytes[0];
+}
+
+// Split s into lines without their newlines.
+static Janet split_lines(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  JanetByteView v = janet_getbytes(argv, 0);
+  JanetArray *a = janet_array(0);
+  push_split(a, v.bytes, v.bytes + v.len, '\n');
+  return janet_wrap_array(a);
+}
+
+// Split s on NUL bytes, as written by find -print0.
+static Janet split_nul(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  JanetByteView v = janet_getbytes(argv, 0);
+  JanetArray *a = janet_array(0);
+  push_split(a, v.bytes, v.bytes + v.len, 0);
+  return janet_wrap_array(a);
+}
+
+// Split a line into fields, on runs of spaces and tabs by default or
+// on each occurrence of a one byte separator, keeping empty fields.
+static Janet split_fields(int32_t argc, Janet *argv) {
+  janet_arity(argc, 1, 2);
+  JanetByteView v = janet_getbytes(argv, 0);
+  JanetArray *a = janet_array(0);
+  const uint8_t *end = v.bytes + v.len;
+  if (argc == 2 && !janet_checktype(argv[1], JANET_NIL)) {
+    uint8_t sep = getsep(argv, 1);
+    const uint8_t *p = v.bytes;
+    for (;;) {
+      const uint8_t *e = memchr(p, sep, end - p);
+      if (!e) {
+        janet_array_push(a, janet_stringv(p, end - p));
+        break;
+      }
+      janet_array_push(a, janet_stringv(p, e - p));
+      p = e + 1;
+    }
+  } else {
+    push_fields(a, v.bytes, end);
+  }
+  return janet_wrap_array(a);
+}
+
+// Split s into lines and each line into fields as split-fields does,
+// returning an array of arrays.
+static Janet split_table(int32_t argc, Janet *argv) {
+  janet_arity(argc, 1, 2);
+  JanetByteView v = janet_getbytes(argv, 0);
+  int blank = argc < 2 || janet_checktype(argv[1], JANET_NIL);
+  uint8_t sep = blank ? 0 : getsep(argv, 1);
+  JanetArray *rows = janet_array(0);
+  const uint8_t *p = v.bytes, *end = v.bytes + v.len;
+  while (p < end) {
+    const uint8_t *e = memchr(p, '\n', end - p);
+    if (!e)
+      e = end;
+    JanetArray *row = janet_array(0);
+    if (blank) {
+      push_fields(row, p, e);
+    } else {
+      const uint8_t *f = p;
+      for (;;) {
+        const uint8_t *fe = memchr(f, sep, e - f);
+        if (!fe) {
+          janet_array_push(row, janet_stringv(f, e - f));
+          break;
+        }
+        janet_array_push(row, janet_stringv(f, fe - f));
+        f = fe + 1;
+      }
+    }
+    janet_array_push(rows, janet_wrap_array(row));
+    p = e + 1;
+  }
+  return janet_wrap_array(rows);
+}
+
+// Environment
+
+extern char **environ;
+
+static Janet environ_(int32_t argc, Janet *argv) {
+  (void)argv;
+  janet_fixarity(argc, 0);
+  JanetArray *a = janet_array(0);
+  for (char **e = environ; *e; e++)
+    janet_array_push(a, janet_cstringv(*e));
+  return janet_wrap_array(a);
+}
+
+// Parse NUL separated NAME=value entries, as written by env -0, into
+// an array of [name value] tuples. Values may contain newlines. Entries
+// without a valid name are skipped.
+static Janet parse_env0(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  JanetByteView v = janet_getbytes(argv, 0);
+  JanetArray *a = janet_array(0);
+  const uint8_t *p = v.bytes, *end = v.bytes + v.len;
+  while (p < end) {
+    const uint8_t *e = memchr(p, 0, end - p);
+    if (!e)
+      e = end;
+    const uint8_t *eq = memchr(p, '=', e - p);
+    int valid = eq && eq != p && !(*p >= '0' && *p <= '9');
+    for (const uint8_t *c = p; valid && c < eq; c++)
+      valid = *c == '_' || (*c >= 'a' && *c <= 'z') ||
+              (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9');
+    if (valid) {
+      Janet *t = janet_tuple_begin(2);
+      t[0] = janet_stringv(p, eq - p);
+      t[1] = janet_stringv(eq + 1, e - eq - 1);
+      janet_array_push(a, janet_wrap_tuple(janet_tuple_end(t)));
+    }
+    p = e + 1;
+  }
+  return janet_wrap_array(a);
+}
+
+// Environment overlays hold overrides of the process environment,
+// "NAME=value" to set and "NAME" to unset, and the envp block built by
+// applying them to environ. The block is only rebuilt when environ has
+// changed since it was built, so an overlay can be reused for many
+// launches.
+
+typedef struct {
+  char **overrides;
+  int32_t noverrides;
+  // The environ entries envp was built from.
+  char **base;
+  size_t nbase;
+  char **envp;
+} EnvOverlay;
+
+static int env_overlay_gc(void *p, size_t len) {
+  (void)len;
+  EnvOverlay *o = p;
+  for (int32_t i = 0; i < o->noverrides; i++)
+    free(o->overrides[i]);
+  free(o->overrides);
+  free(o->base);
+  free(o->envp);
+  return 0;
+}
+
+static struct JanetAbstractType EnvOverlay_jt = {
+    "shlib.env-overlay", env_overlay_gc, NULL, NULL, NULL, NULL, NULL, NULL};
+
+static size_t env_name_len(const char *entry) {
+  const char *eq = strchr(entry, '=');
+  return eq ? (size_t)(eq - entry) : strlen(entry);
+}
+
+static int env_overridden(EnvOverlay *o, const char *entry) {
+  size_t n = env_name_len(entry);
+  for (int32_t i = 0; i < o->noverrides; i++)
+    if (env_name_len(o->overrides[i]) == n &&
+        strncmp(o->overrides[i], entry, n) == 0)
+      return 1;
+  return 0;
+}
+
+static char **env_overlay_envp(EnvOverlay *o) {
+  size_t n = 0;
+  while (environ[n])
+    n++;
+  if (o->envp && n == o->nbase &&
+      memcmp(o->base, environ, n * sizeof(char *)) == 0)
+    return o->envp;
+
+  free(o->base);
+  free(o->envp);
+  o->base = malloc((n + 1) * sizeof(char *));
+  o->envp = malloc((n + o->noverrides + 1) * sizeof(char *));
+  if (!o->base || !o->envp)
+    abort();
+  memcpy(o->base, environ, n * sizeof(char *));
+  o->nbase = n;
+
+  size_t k = 0;
+  for (size_t i = 0; i < n; i++)
+    if (!env_overridden(o, environ[i]))
+      o->envp[k++] = environ[i];
+  for (int32_t i = 0; i < o->noverrides; i++)
+    if (strchr(o->overrides[i], '='))
+      o->envp[k++] = o->overrides[i];
+  o->envp[k] = NULL;
+  return o->envp;
+}
+
+static Janet env_overlay(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  JanetView overrides = janet_getindexed(argv, 0);
+  for (int32_t i = 0; i < overrides.len; i++)
+    if (!janet_checktype(overrides.items[i], JANET_STRING) ||
+        strlen((const char *)janet_unwrap_string(overrides.items[i])) !=
+            (size_t)janet_string_length(
+                janet_unwrap_string(overrides.items[i])))
+      janet_panic("env-overlay: expected strings without NUL bytes");
+
+  EnvOverlay *o = janet_abstract(&EnvOverlay_jt, sizeof(EnvOverlay));
+  memset(o, 0, sizeof(EnvOverlay));
+  o->overrides = malloc((overrides.len + 1) * sizeof(char *));
+  if (!o->overrides)
+    abort();
+  for (int32_t i = 0; i < overrides.len; i++) {
+    o->overrides[i] =
+        strdup((const char *)janet_unwrap_string(overrides.items[i]));
+    if (!o->overrides[i])
+      abort();
+    o->noverrides++;
+  }
+  // Build the block now, so a child forked later can use it as is.
+  env_overlay_envp(o);
+  return janet_wrap_abstract(o);
+}
+
+static Janet env_overlay_environ(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  EnvOverlay *o = janet_getabstract(argv, 0, &EnvOverlay_jt);
+  JanetArray *a = janet_array(0);
+  for (char **e = env_overlay_envp(o); *e; e++)
+    janet_array_push(a, janet_cstringv(*e));
+  return janet_wrap_array(a);
+}
+
+// execve with a PATH search like execvp, using the PATH in envp.
+static void exec_in_env(const char *file, char **child_argv, char **envp) {
+  if (strchr(file, '/')) {
+    execve(file, child_argv, envp);
+    return;
+  }
+  const char *path = "/usr/local/bin:/bin:/usr/bin";
+  for (char **e = envp; *e; e++) {
+    if (strncmp(*e, "PATH=", 5) == 0) {
+      path = *e + 5;
+      break;
+    }
+  }
+
+  size_t flen = strlen(file);
+  int eacces = 0;
+  const char *p = path;
+  for (;;) {
+    const char *end = strchr(p, ':');
+    size_t dlen = end ? (size_t)(end - p) : strlen(p);
+    char buf[PATH_MAX];
+    if (dlen + flen + 3 <= sizeof(buf)) {
+      // An empty PATH element is the current directory.
+      if (dlen == 0) {
+        buf[0] = '.';
+        dlen = 1;
+      } else {
+        memcpy(buf, p, dlen);
+      }
+      buf[dlen] = '/';
+      memcpy(buf + dlen + 1, file, flen + 1);
+      execve(buf, child_argv, envp);
+      if (errno == ENOEXEC) {
+        // Run scripts without a #! line with /bin/sh like execvp.
+        size_t n = 0;
+        while (child_argv[n])
+          n++;
+        char **sh_argv = malloc((n + 2) * sizeof(char *));
+        if (!sh_argv)
+          abort();
+        sh_argv[0] = "sh";
+        sh_argv[1] = buf;
+        memcpy(sh_argv + 2, child_argv + 1, n * sizeof(char *));
+        execve("/bin/sh", sh_argv, envp);
+        free(sh_argv);
+        return;
+      }
+      if (errno == EACCES)
+        eacces = 1;
+      else if (errno != ENOENT && errno != ENOTDIR)
+        return;
+    }
+    if (!end)
+      break;
+    p = end + 1;
+  }
+  errno = eacces ? EACCES : ENOENT;
+}
+
+static Janet exec_overlay(int32_t argc, Janet *argv) {
+  janet_arity(argc, 2, -1);
+  EnvOverlay *o = janet_getabstract(argv, 0, &EnvOverlay_jt);
+  const char **child_argv = malloc(sizeof(char *) * argc);
+  if (!child_argv)
+    abort();
+  for (int32_t i = 1; i < argc; i++)
+    child_argv[i - 1] = janet_getcstring(argv, i);
+  child_argv[argc - 1] = NULL;
+  exec_in_env(child_argv[0], (char **)child_argv, env_overlay_envp(o));
+  int e = errno;
+  free(child_argv);
+  panic_errno("execve", e);
+  abort();
+}
+
+// Server
+
+static Janet unix_listen(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  const char *path = janet_getcstring(argv, 0);
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path))
+    janet_panic("unix-listen: socket path too long");
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1)
+    panic_errno("socket", errno);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  // Replace a socket left behind by a previous server, but nothing
+  // else that happens to be at path.
+  struct stat st;
+  if (lstat(path, &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      close(fd);
+      janet_panicf("unix-listen: %s exists and is not a socket", path);
+    }
+    unlink(path);
+  }
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+      listen(fd, 64) == -1) {
+    int e = errno;
+    close(fd);
+    panic_errno("unix-listen", e);
+  }
+  return janet_wrap_integer(fd);
+}
+
+static Janet unix_accept(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  int fd;
+  do {
+    fd = accept(janet_getinteger(argv, 0), NULL, NULL);
+  } while (fd == -1 && errno == EINTR);
+  if (fd == -1)
+    panic_errno("accept", errno);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  return janet_wrap_integer(fd);
+}
+
+static int read_all(int fd, uint8_t *buf, size_t n) {
+  while (n) {
+    ssize_t r = read(fd, buf, n);
+    if (r == -1 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      return -1;
+    buf += r;
+    n -= r;
+  }
+  return 0;
+}
+
+// Whether the process at the other end of conn runs as our user.
+static int peer_is_our_user(int conn) {
+#ifdef SO_PEERCRED
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1)
+    return 0;
+  return cred.uid == getuid();
+#else
+  uid_t uid;
+  gid_t gid;
+  if (getpeereid(conn, &uid, &gid) == -1)
+    return 0;
+  return uid == getuid();
+#endif
+}
+
+// Receive a janetsh-client request from conn, returning a table with
+// :fds, :cwd, :args and :env. Panics if the request is malformed.
+static Janet recv_request(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 1);
+  int conn = janet_getinteger(argv, 0);
+
+  // Requests run code as us, so only take them from our own user.
+  if (!peer_is_our_user(conn))
+    janet_panic("recv-request: client is not the server's user");
+
+  ServerRequest req;
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(3 * sizeof(int))];
+  } control;
+  struct iovec iov = {.iov_base = &req, .iov_len = sizeof(req)};
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  ssize_t r;
+  do {
+    r = recvmsg(conn, &msg, 0);
+  } while (r == -1 && errno == EINTR);
+  if (r == -1)
+    panic_errno("recvmsg", errno);
+
+  // Take every fd we were passed, so none leak when the request is
+  // rejected. The kernel closes those that didn't fit and sets
+  // MSG_CTRUNC.
+  int fds[3] = {-1, -1, -1};
+  size_t nfds = 0;
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+      cmsg->cmsg_type == SCM_RIGHTS) {
+    nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    if (nfds > 3)
+      nfds = 3;
+    memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof(int));
+  }
+
+  if (r != sizeof(req) || (msg.msg_flags & MSG_CTRUNC) || nfds != 3 ||
+      req.len > SERVER_MAX_REQUEST) {
+    for (int i = 0; i < 3; i++)
+      if (fds[i] != -1)
+        close(fds[i]);
+    janet_panic("recv-request: malformed request");
+  }
+
+  JanetBuffer *buf = janet_buffer(req.len);
+  if (read_all(conn, buf->data, req.len) == -1) {
+    for (int i = 0; i < 3; i++)
+      close(fds[i]);
+    janet_panic("recv-request: truncated request");
+  }
+  buf->count = req.len;
+
+  JanetArray *strs = janet_array(req.nargs + req.nenv + 1);
+  int32_t start = 0;
+  for (int32_t i = 0; i < buf->count; i++) {
+    if (buf->data[i] == 0) {
+      janet_array_push(strs, janet_stringv(buf->data + start, i - start));
+      start = i + 1;
+    }
+  }
+  if ((uint32_t)strs->count != req.nargs + req.nenv + 1) {
+    for (int i = 0; i < 3; i++)
+      close(fds[i]);
+    janet_panic("recv-request: malformed request");
+  }
+
+  Janet *fdt = janet_tuple_begin(3);
+  for (int i = 0; i < 3; i++)
+    fdt[i] = janet_wrap_integer(fds[i]);
+  JanetArray *args = janet_array(req.nargs);
+  for (uint32_t i = 0; i < req.nargs; i++)
+    janet_array_push(args, strs->data[1 + i]);
+  JanetArray *env = janet_array(req.nenv);
+  for (uint32_t i = 0; i < req.nenv; i++)
+    janet_array_push(env, strs->data[1 + req.nargs + i]);
+
+  JanetTable *t = janet_table(4);
+  janet_table_put(t, janet_ckeywordv("fds"),
+                  janet_wrap_tuple(janet_tuple_end(fdt)));
+  janet_table_put(t, janet_ckeywordv("cwd"), strs->data[0]);
+  janet_table_put(t, janet_ckeywordv("args"), janet_wrap_array(args));
+  janet_table_put(t, janet_ckeywordv("env"), janet_wrap_array(env));
+  return janet_wrap_table(t);
+}
+
+static Janet send_int(int32_t argc, Janet *argv) {
+  janet_fixarity(argc, 2);
+  int32_t n = janet_getinteger(argv, 1);
+  if (write_all(janet_getinteger(argv, 0), (const uint8_t *)&n, sizeof(n)) ==
+      -1)
+    panic_errno("send-int", errno);
+  return janet_wrap_nil();
+}
+
+static Janet clearenv_(int32_t argc, Janet *argv) {
+  (void)argv;
+  janet_fixarity(argc, 0);
+  if (clearenv() != 0)
+    janet_panic("clearenv: failed");
+  return janet_wrap_nil();
+}
+
 static const JanetReg cfuns[] = {
     // Unistd / Libc
     {"glob", glob_, NULL},
@@ -565,6 +1895,11 @@ static const JanetReg cfuns[] = {
     {"kill", kill_, NULL},
     {"open", open_, NULL},
     {"close", close_, NULL},
+    {"chmod", chmod_, NULL},
+    {"fchmod", fchmod_, NULL},
+    {"cloexec", cloexec, NULL},
+    {"read", read_, NULL},
+    {"write", write_, NULL},
     {"pipe", pipe_, NULL},
     {"waitpid", waitpid_, NULL},
     {"WIFEXITED", WIFEXITED_, NULL},
@@ -574,6 +1909,46 @@ static const JanetReg cfuns[] = {
     {"WSTOPSIG", WSTOPSIG_, NULL},
     {"WIFSTOPPED", WIFSTOPPED_, NULL},
     {"WIFCONTINUED", WIFCONTINUED_, NULL},
+    {"call-in-child", call_in_child, NULL},
+    {"call-in-background", call_in_background, NULL},
+
+    // completion
+    {"fuzzy-match", fuzzy_match, NULL},
+
+    // pipeline stages
+    {"call-stage", call_stage, NULL},
+    {"copy-fd", copy_fd, NULL},
+    {"tee-fds", tee_fds, NULL},
+    {"capture-fds", capture_fds, NULL},
+    {"poll-readable", poll_readable, NULL},
+
+    // shared memory
+    {"shm-create", shm_create, NULL},
+    {"shm-write", shm_write, NULL},
+    {"shm-read", shm_read, NULL},
+
+    // redirect sources
+    {"data-fd", data_fd, NULL},
+
+    // splitting
+    {"split-lines", split_lines, NULL},
+    {"split-nul", split_nul, NULL},
+    {"split-fields", split_fields, NULL},
+    {"split-table", split_table, NULL},
+
+    // environment
+    {"environ", environ_, NULL},
+    {"parse-env0", parse_env0, NULL},
+    {"env-overlay", env_overlay, NULL},
+    {"env-overlay-environ", env_overlay_environ, NULL},
+    {"exec-overlay", exec_overlay, NULL},
+
+    // server
+    {"unix-listen", unix_listen, NULL},
+    {"unix-accept", unix_accept, NULL},
+    {"recv-request", recv_request, NULL},
+    {"send-int", send_int, NULL},
+    {"clearenv", clearenv_, NULL},
 
     // signal handlers
     {"register-unsafe-child-cleanup-array", register_unsafe_child_cleanup_array,
@@ -598,7 +1973,13 @@ static const JanetReg cfuns[] = {
 
     {NULL, NULL, NULL}};
 
+// The static janetsh executable links shlib in and registers it
+// itself rather than loading it as a native module.
+#ifdef SHLIB_STATIC
+void shlib_register(JanetTable *env) {
+#else
 JANET_MODULE_ENTRY(JanetTable *env) {
+#endif
   janet_cfuns(env, "shlib", cfuns);
 
   // This code assumes pid_t will fit in a janet number.
@@ -618,6 +1999,7 @@ JANET_MODULE_ENTRY(JanetTable *env) {
   DEF_CONSTANT_INT(SIGCHLD);
   DEF_CONSTANT_INT(SIGTERM);
   DEF_CONSTANT_INT(SIGPIPE);
+  DEF_CONSTANT_INT(SIGKILL);
 
   DEF_CONSTANT_INT(SIG_BLOCK);
   DEF_CONSTANT_INT(SIG_UNBLOCK);
@@ -631,6 +2013,7 @@ JANET_MODULE_ENTRY(JanetTable *env) {
 
   DEF_CONSTANT_INT(S_IWUSR);
   DEF_CONSTANT_INT(S_IRUSR);
+  DEF_CONSTANT_INT(S_IXUSR);
   DEF_CONSTANT_INT(S_IRGRP);
 
   DEF_CONSTANT_INT(TCSADRAIN);
@@ -0,0 +1,46 @@
+// Entry point of the static janetsh executable, which links janet,
+// shlib and readnoise into one binary and runs the janetsh script
+// with the sh image built in, so nothing is looked up, compiled or
+// dlopened at startup.
+#include <janet.h>
+#include <stdlib.h>
+
+// Generated by support/embed.janet.
+extern const unsigned char janetsh_script[];
+extern const size_t janetsh_script_len;
+extern const unsigned char janetsh_sh_image[];
+extern const size_t janetsh_sh_image_len;
+
+void shlib_register(JanetTable *env);
+
+int main(int argc, char **argv) {
+  janet_init();
+  JanetTable *env = janet_core_env(NULL);
+
+  // janetsh expects its options after the interpreter and script
+  // name, as when run by janet.
+  JanetArray *args = janet_array(argc + 1);
+  janet_array_push(args, janet_cstringv(argv[0]));
+  for (int i = 0; i < argc; i++)
+    janet_array_push(args, janet_cstringv(argv[i]));
+  janet_def(env, "process/args", janet_wrap_array(args),
+            "Command line arguments.");
+
+  JanetTable *shlib_env = janet_table(0);
+  shlib_register(shlib_env);
+
+  JanetTable *modules = janet_table(2);
+  janet_table_put(modules, janet_cstringv("shlib"),
+                  janet_wrap_table(shlib_env));
+  janet_table_put(modules, janet_cstringv("sh.jimage"),
+                  janet_stringv(janetsh_sh_image, janetsh_sh_image_len));
+  janet_def(env, "janetsh/static-modules", janet_wrap_table(modules),
+            "Modules built into the static janetsh executable.");
+
+  // janetsh exits by itself unless it fails to compile.
+  Janet out;
+  int status = janet_dobytes(env, janetsh_script, janetsh_script_len,
+                             "janetsh", &out);
+  janet_deinit();
+  return status ? 1 : 0;
+}